@@ -0,0 +1,48 @@
+#!/bin/sh
+# Run the solvers a number of times and write the results as csv, one line per run:
+#   solver,size,iters,threads,run,time,error,host,cpu,compiler,date
+#
+# usage:
+#   ./benchmark.sh build_dir output.csv [runs]
+#
+# The result is compared against result/baseline.csv with benchmark_compare (make benchmark-check).
+
+BUILD=${1:-build}
+OUTPUT=${2:-result/benchmark.csv}
+RUNS=${3:-5}
+
+HOST=$(hostname)
+CPU=$(grep -m1 "model name" /proc/cpuinfo 2>/dev/null | cut -d: -f2 | sed 's/^ *//; s/,/ /g')
+COMPILER=$(${CC:-gcc} --version | head -n 1 | sed 's/,/ /g')
+DATE=$(date +%Y-%m-%d)
+
+# solver, arguments (size iters [workers] [option]) of every benchmarked case
+CASES="jacobi_seq:100 10000
+jacobi_parallel:100 10000 1
+jacobi_parallel:100 10000 2
+jacobi_parallel:100 10000 4
+multigrid_seq:12 100000
+multigrid_parallel:12 100000 1
+multigrid_parallel:12 100000 2
+multigrid_parallel:12 100000 4
+cg_parallel:255 1000 1 1
+cg_parallel:255 1000 4 1"
+
+mkdir -p "$(dirname "$OUTPUT")"
+echo "solver,size,iters,threads,run,time,error,host,cpu,compiler,date" > "$OUTPUT"
+
+echo "$CASES" | while IFS=: read SOLVER ARGS; do
+    set -- $ARGS
+    SIZE=$1
+    ITERS=$2
+    THREADS=${3:-1}
+    RUN=1
+    while [ $RUN -le $RUNS ]; do
+        # every solver prints "size iters [workers]<tab>time<tab>...<tab>error"
+        LINE=$("$BUILD"/$SOLVER $ARGS) || exit 1
+        TIME=$(echo "$LINE" | awk -F'\t' '{print $2}')
+        ERROR=$(echo "$LINE" | awk -F'\t' '{print $NF}')
+        echo "$SOLVER,$SIZE,$ITERS,$THREADS,$RUN,$TIME,$ERROR,$HOST,$CPU,$COMPILER,$DATE" >> "$OUTPUT"
+        RUN=$((RUN + 1))
+    done
+done
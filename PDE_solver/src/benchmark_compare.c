@@ -0,0 +1,180 @@
+/* A program to compare two benchmark runs of the solvers, written by benchmark.sh, and flag slowdowns
+    @Author Jakob Berggren, Oskar Hahr
+
+    usage with gcc:
+        gcc -O -o benchmark_compare benchmark_compare.c -lm
+        ./benchmark_compare baseline.csv current.csv threshold
+
+    The runs of every case (solver, size, iters, threads, host, cpu) are grouped, and a case is a regression when its
+    mean time is more than threshold (default 0.05 = 5%) slower than the baseline, and the difference is
+    significant in a one sided Welch t-test at the 95% level. The program exits with 1 if any case regressed,
+    so it can be used as a gate. Times from another host or cpu are not comparable, such cases are reported
+    as other host, and if no case of the current run has a baseline on its host and cpu the program refuses
+    to compare and exits with 2, record a baseline on this machine with make benchmark-baseline.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#define MAXCASES 256
+#define MAXLINE 1024
+#define THRESHOLD 0.05
+
+/* all runs of one benchmark case */
+typedef struct{
+    char solver[64], host[64], cpu[128];
+    int size, iters, threads;
+    int n;
+    double sum, sumsq;
+} benchcase;
+
+/* one sided 95% critical values of Student's t for 1 to 30 degrees of freedom */
+const double tcrit[30] = {
+    6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812,
+    1.796, 1.782, 1.771, 1.761, 1.753, 1.746, 1.740, 1.734, 1.729, 1.725,
+    1.721, 1.717, 1.714, 1.711, 1.708, 1.706, 1.703, 1.701, 1.699, 1.697
+};
+
+/* true if a and b are the same solver, size, iters and threads, on any host */
+bool sameCase(const benchcase* a, const benchcase* b){
+    return strcmp(a->solver, b->solver) == 0 && a->size == b->size && a->iters == b->iters && a->threads == b->threads;
+}
+
+/* true if a and b were run on the same host and cpu */
+bool sameHost(const benchcase* a, const benchcase* b){
+    return strcmp(a->host, b->host) == 0 && strcmp(a->cpu, b->cpu) == 0;
+}
+
+benchcase* find(benchcase* cases, int* count, const benchcase* key){
+    int i;
+    for(i = 0; i < *count; i++){
+        if(sameCase(&cases[i], key) && sameHost(&cases[i], key))
+            return &cases[i];
+    }
+    if(*count == MAXCASES)
+        return NULL;
+    cases[*count] = *key;
+    return &cases[(*count)++];
+}
+
+/* Read a csv written by benchmark.sh, returns the number of cases or -1 if the file can't be read */
+int readResults(const char* file, benchcase* cases){
+    char line[MAXLINE];
+    int count = 0, run;
+    double time;
+    benchcase key, *c;
+    FILE* input = fopen(file, "r");
+
+    if(input == NULL){
+        fprintf(stderr, "can't read %s\n", file);
+        return -1;
+    }
+    /* skip the header */
+    if(fgets(line, MAXLINE, input) == NULL){
+        fclose(input);
+        return 0;
+    }
+    while(fgets(line, MAXLINE, input) != NULL){
+        /* solver,size,iters,threads,run,time,error,host,cpu,... */
+        memset(&key, 0, sizeof(key));
+        if(sscanf(line, "%63[^,],%d,%d,%d,%d,%lf,%*[^,],%63[^,],%127[^,]", key.solver, &key.size, &key.iters,
+                  &key.threads, &run, &time, key.host, key.cpu) < 6)
+            continue;
+        c = find(cases, &count, &key);
+        if(c == NULL)
+            break;
+        c->n++;
+        c->sum += time;
+        c->sumsq += time*time;
+    }
+    fclose(input);
+    return count;
+}
+
+double mean(benchcase* c){
+    return c->sum / c->n;
+}
+
+double variance(benchcase* c){
+    double m = mean(c);
+    if(c->n < 2)
+        return 0.0;
+    return (c->sumsq - c->n*m*m) / (c->n - 1);
+}
+
+int main(int argc, char const *argv[])
+{
+    int i, k, baseCount, currentCount, regressions = 0, compared = 0, otherHost = 0;
+    double threshold, change, se, t, df, va, vb;
+    benchcase *current, *b, *other;
+    static benchcase baseCases[MAXCASES], currentCases[MAXCASES];
+
+    if(argc < 3){
+        fprintf(stderr, "usage: %s baseline.csv current.csv [threshold]\n", argv[0]);
+        return 2;
+    }
+    threshold = (argc > 3)? atof(argv[3]) : THRESHOLD;
+
+    baseCount = readResults(argv[1], baseCases);
+    currentCount = readResults(argv[2], currentCases);
+    if(baseCount < 0 || currentCount < 0)
+        return 2;
+
+    printf("solver\tsize\titers\tthreads\tbaseline\tcurrent\tchange\tt\tresult\n");
+    for(i = 0; i < currentCount; i++){
+        current = &currentCases[i];
+        b = other = NULL;
+        for(k = 0; k < baseCount; k++){
+            if(sameCase(&baseCases[k], current)){
+                if(sameHost(&baseCases[k], current))
+                    b = &baseCases[k];
+                else
+                    other = &baseCases[k];
+            }
+        }
+        printf("%s\t%d\t%d\t%d\t", current->solver, current->size, current->iters, current->threads);
+        if(b == NULL && other != NULL){
+            printf("-\t%g\t-\t-\tother host\n", mean(current));
+            otherHost++;
+            continue;
+        }
+        if(b == NULL){
+            printf("-\t%g\t-\t-\tnew\n", mean(current));
+            continue;
+        }
+        compared++;
+
+        /* Welch t-test on the mean times, with the Welch-Satterthwaite degrees of freedom */
+        va = variance(b) / b->n;
+        vb = variance(current) / current->n;
+        se = sqrt(va + vb);
+        change = (mean(current) - mean(b)) / mean(b);
+        t = (se > 0)? (mean(current) - mean(b)) / se : 0.0;
+        df = (va + vb > 0 && b->n > 1 && current->n > 1)?
+            (va + vb)*(va + vb) / (va*va/(b->n - 1) + vb*vb/(current->n - 1)) : 1.0;
+        if(df < 1)
+            df = 1;
+
+        printf("%g\t%g\t%+.1f%%\t%.2f\t", mean(b), mean(current), 100.0*change, t);
+        if(change > threshold && (se == 0 || t > ((df > 30)? 1.645 : tcrit[(int)df - 1]))){
+            printf("REGRESSION\n");
+            regressions++;
+        }
+        else if(change < -threshold && (se == 0 || -t > ((df > 30)? 1.645 : tcrit[(int)df - 1])))
+            printf("faster\n");
+        else
+            printf("ok\n");
+    }
+
+    if(compared == 0 && otherHost > 0){
+        fprintf(stderr, "the baseline was recorded on another host or cpu than %s (%s), record one here with "
+                "make benchmark-baseline\n", currentCases[0].host, currentCases[0].cpu);
+        return 2;
+    }
+    if(regressions > 0)
+        printf("%d of %d cases are significantly slower than the baseline\n", regressions, currentCount);
+    return (regressions > 0)? 1 : 0;
+}
@@ -0,0 +1,361 @@
+/* A roofline style benchmark of the kernels in multigrid_parallel, run one at a time using openmp
+    @Author Jakob Berggren, Oskar Hahr
+
+    usage with gcc (version 4.2 or higher required) and :
+        gcc -O -fopenmp -o benchmark_kernels benchmark_kernels.c -lm
+        ./benchmark_kernels workers peak
+
+    Every kernel (jacobi sweep, restriction, interpolation, maxDiff) is run in isolation on grid sizes
+    from ones that fit in L1 up to ones that only fit in DRAM. After WARMUP untimed runs, REPS samples
+    are taken and the median, min and standard deviation are reported. The bandwidth roof is measured
+    with a STREAM triad and the compute roof with vectorized multiply-adds on independent accumulators
+    (fused, with AVX2, if the cpu has it), unless peak (GFLOP/s) is given. The
+    percent of roofline is the achieved GFLOP/s over min(peak, bandwidth * flops per byte), sizes that
+    fit in cache can go above 100% since the bandwidth roof is the one of DRAM.
+*/
+
+#include <omp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/time.h>
+#include <math.h>
+#include <limits.h>
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
+#define MAXWORKERS 4
+
+/* samples per kernel and size, and untimed runs before them */
+#define REPS 11
+#define WARMUP 2
+/* each sample runs the kernel until about this many points are touched, so small grids are timed over many calls */
+#define SAMPLEPOINTS (1 << 24)
+/* STREAM arrays are large enough to not fit in any cache */
+#define STREAMSIZE (1 << 24)
+
+#define KERNELS 4
+#define SWEEP 0
+#define RESTRICT 1
+#define INTERPOLATE 2
+#define MAXDIFF 3
+
+int workers;
+double maxdiff, bandwidth, peak;
+const char* kernelNames[KERNELS] = {"sweep", "restriction", "interpolation", "maxDiff"};
+/* modelled bytes moved and flops per point written (per point read for maxDiff), the same model as the PROFILE build of multigrid_parallel */
+const double kernelBytes[KERNELS] = {16, 40, 10, 16};
+const double kernelFlops[KERNELS] = {4, 17, 1.25, 2};
+/* the fine grids are 2n+1 points wide and the coarse grids n+1, spanning L1 (16) to DRAM (2048) */
+const int sizes[] = {16, 32, 64, 128, 256, 512, 1024, 2048};
+
+/* One jacobi half sweep from a to b */
+void sweep(double** a, double** b, int size){
+    int i, j;
+    int interiorSize = size - 1;
+
+    #pragma omp parallel for private(j)
+    for(i = 1; i < interiorSize; i++){
+        for(j = 1; j < interiorSize; j++){
+            b[i][j] = (a[i-1][j] + a[i+1][j] + a[i][j-1] +a[i][j+1]) * 0.25;
+        }
+    }
+}
+
+/* Full weighting restriction, same as in multigrid_parallel */
+void restriction(double** fine, double** coarse, int size){
+    int i, j, x, y;
+    int sizeC = size-1;
+
+    #pragma omp parallel for private(j, x, y)
+    for(i = 1; i < sizeC; i++)
+    {
+        double *up, *mid, *down;
+        x = i << 1;
+        up = fine[x-1];
+        mid = fine[x];
+        down = fine[x+1];
+        for(j = 1; j < sizeC; j++)
+        {
+            y = j << 1;
+            coarse[i][j] = mid[y]*0.25
+                + (up[y] + down[y] + mid[y-1] + mid[y+1]) * 0.125
+                + (up[y-1] + up[y+1] + down[y-1] + down[y+1]) * 0.0625;
+        }
+    }
+}
+
+/* Single pass bilinear interpolation, same as in multigrid_parallel */
+void interpolation(double** coarse, double** fine, int sizeFine, int sizeCoarse){
+    int x, j;
+    int sizeF = sizeFine - 1;
+    int sizeC = sizeCoarse - 1;
+
+    #pragma omp parallel for private(j)
+    for(x = 1; x < sizeF; x++)
+    {
+        double *row = fine[x];
+        double *c0 = coarse[x >> 1];
+        double *c1 = coarse[(x + 1) >> 1];
+        double left, right;
+
+        if((x & 1) == 0){
+            for(j = 0; j < sizeC; j++){
+                if(j > 0)
+                    row[j << 1] = c0[j];
+                row[(j << 1) + 1] = (c0[j] + c0[j+1]) * 0.5;
+            }
+        }
+        else{
+            left = (c0[0] + c1[0]) * 0.5;
+            for(j = 0; j < sizeC; j++){
+                right = (c0[j+1] + c1[j+1]) * 0.5;
+                if(j > 0)
+                    row[j << 1] = left;
+                row[(j << 1) + 1] = (left + right) * 0.5;
+                left = right;
+            }
+        }
+    }
+}
+
+/* Max difference between a & b, same as in multigrid_parallel */
+void maxDiff(double** a, double** b, int size){
+    int i, j;
+    double temp;
+
+    #pragma omp parallel for private(j, temp)
+    for(i = 0; i < size; i++)
+    {
+        for(j = 0; j < size; j++){
+            temp = a[i][j] - b[i][j];
+            if(temp < 0)
+                temp = -temp;
+            if(temp > maxdiff){
+                #pragma omp critical
+                if(temp > maxdiff)
+                    maxdiff = temp;
+            }
+        }
+    }
+}
+
+/* STREAM triad a = b + s*c, returns the best bandwidth in bytes per second */
+double stream(){
+    int i, rep;
+    double t, best = 0.0;
+    double *a = malloc(STREAMSIZE*sizeof(double));
+    double *b = malloc(STREAMSIZE*sizeof(double));
+    double *c = malloc(STREAMSIZE*sizeof(double));
+
+    #pragma omp parallel for
+    for(i = 0; i < STREAMSIZE; i++){
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+    for(rep = 0; rep < REPS; rep++){
+        t = omp_get_wtime();
+        #pragma omp parallel for
+        for(i = 0; i < STREAMSIZE; i++)
+            a[i] = b[i] + 3.0*c[i];
+        t = omp_get_wtime() - t;
+        if(3.0 * STREAMSIZE * sizeof(double) / t > best)
+            best = 3.0 * STREAMSIZE * sizeof(double) / t;
+    }
+    free(a);
+    free(b);
+    free(c);
+    return best;
+}
+
+/* n flops as multiply-adds on 8 independent chains of four lanes each (64 flops a pass), so there are
+enough of them in flight to cover the latency of the multiply-add units. Returns their sum */
+typedef double vdouble __attribute__((vector_size(32)));
+
+double flopLoop(long n){
+    long k;
+    vdouble m = {0.999999, 0.999999, 0.999999, 0.999999}, c = {0.000001, 0.000001, 0.000001, 0.000001};
+    vdouble x0 = {0, 1, 2, 3}, x1 = x0 + 4, x2 = x0 + 8, x3 = x0 + 12;
+    vdouble x4 = x0 + 16, x5 = x0 + 20, x6 = x0 + 24, x7 = x0 + 28;
+
+    for(k = 0; k < n / 64; k++){
+        x0 = x0*m + c;
+        x1 = x1*m + c;
+        x2 = x2*m + c;
+        x3 = x3*m + c;
+        x4 = x4*m + c;
+        x5 = x5*m + c;
+        x6 = x6*m + c;
+        x7 = x7*m + c;
+    }
+    x0 = x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7;
+    return x0[0] + x0[1] + x0[2] + x0[3];
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+/* the same loop with AVX2 fused multiply-adds, used when the cpu has them */
+__attribute__((target("avx2,fma"))) double flopLoopFMA(long n){
+    long k;
+    __m256d m = _mm256_set1_pd(0.999999), c = _mm256_set1_pd(0.000001);
+    __m256d x0 = _mm256_setr_pd(0, 1, 2, 3), x1 = _mm256_add_pd(x0, _mm256_set1_pd(4));
+    __m256d x2 = _mm256_add_pd(x1, _mm256_set1_pd(4)), x3 = _mm256_add_pd(x2, _mm256_set1_pd(4));
+    __m256d x4 = _mm256_add_pd(x3, _mm256_set1_pd(4)), x5 = _mm256_add_pd(x4, _mm256_set1_pd(4));
+    __m256d x6 = _mm256_add_pd(x5, _mm256_set1_pd(4)), x7 = _mm256_add_pd(x6, _mm256_set1_pd(4));
+    double lanes[4];
+
+    for(k = 0; k < n / 64; k++){
+        x0 = _mm256_fmadd_pd(x0, m, c);
+        x1 = _mm256_fmadd_pd(x1, m, c);
+        x2 = _mm256_fmadd_pd(x2, m, c);
+        x3 = _mm256_fmadd_pd(x3, m, c);
+        x4 = _mm256_fmadd_pd(x4, m, c);
+        x5 = _mm256_fmadd_pd(x5, m, c);
+        x6 = _mm256_fmadd_pd(x6, m, c);
+        x7 = _mm256_fmadd_pd(x7, m, c);
+    }
+    x0 = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(x0, x1), _mm256_add_pd(x2, x3)),
+                       _mm256_add_pd(_mm256_add_pd(x4, x5), _mm256_add_pd(x6, x7)));
+    _mm256_storeu_pd(lanes, x0);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+/* Compute roof, independent vectorized multiply-adds on values that stay in registers. Returns flops per second */
+double flops(){
+    int rep;
+    long n = 1L << 28;
+    double t, best = 0.0, sum = 0.0;
+    bool fma = false;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    fma = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    for(rep = 0; rep < 3; rep++){
+        t = omp_get_wtime();
+        #pragma omp parallel reduction(+:sum)
+        {
+#if defined(__x86_64__) && defined(__GNUC__)
+            sum += fma? flopLoopFMA(n) : flopLoop(n);
+#else
+            sum += flopLoop(n);
+#endif
+        }
+        t = omp_get_wtime() - t;
+        if(n * omp_get_max_threads() / t > best)
+            best = n * omp_get_max_threads() / t;
+    }
+    /* keep the loop from being optimized away */
+    if(sum < 0)
+        printf("%g\n", sum);
+    return best;
+}
+
+/* Allocate a grid with boundary points = 1 and interior points = 0 */
+double** allocGrid(int s){
+    int i, j;
+    double** g = malloc(s*sizeof(double*));
+    for(i = 0; i < s; i++){
+        g[i] = malloc(s*sizeof(double));
+        for(j = 0; j < s; j++)
+            g[i][j] = (i == 0 || j == 0 || i == s-1 || j == s-1)? 1 : 0;
+    }
+    return g;
+}
+
+void freeGrid(double** g, int s){
+    int i;
+    for(i = 0; i < s; i++)
+        free(g[i]);
+    free(g);
+}
+
+void run(int kernel, double** fine, double** fine2, double** coarse, int sizeF, int sizeC){
+    switch(kernel){
+        case SWEEP: sweep(fine, fine2, sizeF); break;
+        case RESTRICT: restriction(fine, coarse, sizeC); break;
+        case INTERPOLATE: interpolation(coarse, fine, sizeF, sizeC); break;
+        case MAXDIFF: maxDiff(fine, fine2, sizeF); break;
+    }
+}
+
+int compare(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Time one kernel on one grid size and print its line of the report */
+void benchmark(int kernel, int n){
+    int rep, k, calls;
+    int sizeF = 2*n + 1, sizeC = n + 1;
+    double samples[REPS], t, mean = 0.0, var = 0.0, points, gflops, roof;
+    double **fine = allocGrid(sizeF), **fine2 = allocGrid(sizeF), **coarse = allocGrid(sizeC);
+
+    /* points each call writes, maxDiff is counted on the points it reads */
+    if(kernel == RESTRICT)
+        points = (double)(sizeC - 2) * (sizeC - 2);
+    else if(kernel == MAXDIFF)
+        points = (double)sizeF * sizeF;
+    else
+        points = (double)(sizeF - 2) * (sizeF - 2);
+    calls = SAMPLEPOINTS / points;
+    if(calls < 1)
+        calls = 1;
+
+    for(rep = 0; rep < WARMUP; rep++)
+        run(kernel, fine, fine2, coarse, sizeF, sizeC);
+    for(rep = 0; rep < REPS; rep++){
+        t = omp_get_wtime();
+        for(k = 0; k < calls; k++)
+            run(kernel, fine, fine2, coarse, sizeF, sizeC);
+        samples[rep] = (omp_get_wtime() - t) / calls;
+        mean += samples[rep];
+    }
+    mean /= REPS;
+    for(rep = 0; rep < REPS; rep++)
+        var += (samples[rep] - mean) * (samples[rep] - mean);
+    qsort(samples, REPS, sizeof(double), compare);
+
+    /* roofline from the median time */
+    gflops = points * kernelFlops[kernel] / samples[REPS/2] * 1e-9;
+    roof = bandwidth * kernelFlops[kernel] / kernelBytes[kernel] * 1e-9;
+    if(roof > peak * 1e-9)
+        roof = peak * 1e-9;
+
+    printf("%s\t%d\t%g\t", kernelNames[kernel], sizeF - 2, points * kernelBytes[kernel]);
+    printf("%g\t%g\t%g\t", samples[REPS/2], samples[0], sqrt(var / (REPS - 1)));
+    printf("%g\t%g\t", points * kernelBytes[kernel] / samples[REPS/2] * 1e-9, gflops);
+    printf("%.1f%%\n", 100.0 * gflops / roof);
+
+    freeGrid(fine, sizeF);
+    freeGrid(fine2, sizeF);
+    freeGrid(coarse, sizeC);
+}
+
+
+int main(int argc, char const *argv[])
+{
+    int k, s;
+
+    workers = (argc > 1)? atoi(argv[1]) : MAXWORKERS;
+    peak = (argc > 2)? atof(argv[2]) * 1e9 : 0.0;
+    if(workers > MAXWORKERS) workers = MAXWORKERS;
+
+    /* set number of workers */
+    omp_set_num_threads(workers);
+
+    bandwidth = stream();
+    if(peak <= 0)
+        peak = flops();
+    printf("workers %d\tstream triad %g GB/s\tpeak %g GFLOP/s\n", workers, bandwidth * 1e-9, peak * 1e-9);
+    printf("kernel\tsize\tbytes\tmedian\tmin\tstddev\tGB/s\tGFLOP/s\troofline\n");
+
+    for(k = 0; k < KERNELS; k++)
+        for(s = 0; s < (int)(sizeof(sizes)/sizeof(sizes[0])); s++)
+            benchmark(k, sizes[s]);
+
+    return 0;
+}
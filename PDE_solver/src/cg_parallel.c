@@ -0,0 +1,431 @@
+/* A program to solve the jacobi grid problem with the conjugate gradient method in parallel using openmp
+    @Author Jakob Berggren, Oskar Hahr
+
+    usage with gcc (version 4.2 or higher required) and :
+        gcc -O -fopenmp -o cg_parallel cg_parallel.c -lm
+        ./cg_parallel size iters workers precond
+
+    precond = 0 runs plain CG, precond = 1 uses one multigrid V-cycle as preconditioner.
+    The V-cycle coarsens as long as the interior size is odd, so sizes of the form 2^k - 1
+    give the deepest hierarchy.
+*/
+
+#include <omp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/time.h>
+#include <math.h>
+#include <limits.h>
+#include <string.h>
+
+/* MAX for: Grid size, Number of Iterations and Working threads */
+#define MAXSIZE 1000
+#define MAXITERS 1000000
+#define MAXWORKERS 4
+
+/* max number of levels in the V-cycle and jacobi sweeps done on each of them */
+#define MAXLEVELS 12
+#define SWEEPS 2
+#define COARSESWEEPS 20
+#define WEIGHT 0.8
+
+/* the CG iteration stops when the largest residual is below TOLERANCE */
+#define TOLERANCE 1e-10
+
+/* One level of the V-cycle, solving A u = f where A is the 5-point laplacian scaled with h2 */
+typedef struct{
+    int size;
+    double h2;
+    double **u, **f, **t;
+} level;
+
+int size, iters, workers, precond, numLevels;
+double start_time, end_time;
+level levels[MAXLEVELS];
+FILE* output;
+
+/* Allocate a grid of size x size points, all set to zero */
+double** allocGrid(int s){
+    int i;
+    double** g = malloc(s*sizeof(double*));
+    for(i = 0; i < s; i++)
+        g[i] = calloc(s, sizeof(double));
+    return g;
+}
+
+void freeGrid(double** g, int s){
+    int i;
+    for(i = 0; i < s; i++)
+        free(g[i]);
+    free(g);
+}
+
+/* Matrix-free product q = A p over the interior points, returns the dot product p.q */
+double applyA(double** p, double** q){
+    int i, j;
+    int interiorSize = size - 1;
+    double pq = 0.0;
+
+    #pragma omp parallel for private(j) reduction(+:pq)
+    for(i = 1; i < interiorSize; i++){
+        for(j = 1; j < interiorSize; j++){
+            q[i][j] = 4.0*p[i][j] - (p[i-1][j] + p[i+1][j] + p[i][j-1] + p[i][j+1]);
+            pq += p[i][j]*q[i][j];
+        }
+    }
+    return pq;
+}
+
+/* Fused update x += alpha p, r -= alpha q. If rold is given the old residual is saved
+in it on the same pass. Returns the largest remaining residual. */
+double update(double** x, double** r, double** rold, double** p, double** q, double alpha){
+    int i, j;
+    int interiorSize = size - 1;
+    double rmax = 0.0;
+
+    #pragma omp parallel for private(j) reduction(max:rmax)
+    for(i = 1; i < interiorSize; i++){
+        for(j = 1; j < interiorSize; j++){
+            x[i][j] += alpha*p[i][j];
+            if(rold != NULL)
+                rold[i][j] = r[i][j];
+            r[i][j] -= alpha*q[i][j];
+            if(fabs(r[i][j]) > rmax)
+                rmax = fabs(r[i][j]);
+        }
+    }
+    return rmax;
+}
+
+/* Parallel dot product of the interior points of a & b */
+double dot(double** a, double** b){
+    int i, j;
+    int interiorSize = size - 1;
+    double sum = 0.0;
+
+    #pragma omp parallel for private(j) reduction(+:sum)
+    for(i = 1; i < interiorSize; i++){
+        for(j = 1; j < interiorSize; j++){
+            sum += a[i][j]*b[i][j];
+        }
+    }
+    return sum;
+}
+
+/* New search direction p = z + beta p */
+void direction(double** p, double** z, double beta){
+    int i, j;
+    int interiorSize = size - 1;
+
+    #pragma omp parallel for private(j)
+    for(i = 1; i < interiorSize; i++){
+        for(j = 1; j < interiorSize; j++){
+            p[i][j] = z[i][j] + beta*p[i][j];
+        }
+    }
+}
+
+/* Weighted jacobi sweeps on A u = f, using t as the second grid */
+void smooth(level* l, int sweeps){
+    int i, j, count;
+    int interiorSize = l->size - 1;
+    double **u = l->u, **f = l->f, **t = l->t, h2 = l->h2;
+
+    for(count = 0; count < sweeps; count++)
+    {
+        #pragma omp parallel
+        {
+            #pragma omp for private(j)
+            for(i = 1; i < interiorSize; i++){
+                for(j = 1; j < interiorSize; j++){
+                    t[i][j] = (1.0 - WEIGHT)*u[i][j] + WEIGHT*0.25*(u[i-1][j] + u[i+1][j] + u[i][j-1] + u[i][j+1] + h2*f[i][j]);
+                }
+            }
+            #pragma omp for private(j)
+            for(i = 1; i < interiorSize; i++){
+                for(j = 1; j < interiorSize; j++){
+                    u[i][j] = (1.0 - WEIGHT)*t[i][j] + WEIGHT*0.25*(t[i-1][j] + t[i+1][j] + t[i][j-1] + t[i][j+1] + h2*f[i][j]);
+                }
+            }
+        }
+    }
+}
+
+/* Residual t = f - A u of a level */
+void residual(level* l){
+    int i, j;
+    int interiorSize = l->size - 1;
+    double **u = l->u, **f = l->f, **t = l->t, h2 = l->h2;
+
+    #pragma omp parallel for private(j)
+    for(i = 1; i < interiorSize; i++){
+        for(j = 1; j < interiorSize; j++){
+            t[i][j] = f[i][j] - (4.0*u[i][j] - (u[i-1][j] + u[i+1][j] + u[i][j-1] + u[i][j+1])) / h2;
+        }
+    }
+}
+
+/* Parallel restriction function, the restriction function is used to project the values of a fine grid onto a coarse grid. 
+This function is used to down a level in the V-Cycle. Full weighting over the 9 fine points around each coarse point,
+each coarse point is written once in a single pass over the fine grid. */
+void restriction(double** fine, double** coarse, int size){
+
+    int i, j, x, y;
+    int sizeC = size-1;
+    /* iterate over the coarse matrix, mapping has a 1:2 relation between the coarse matrix to the fine matrix in regards to i,j : x,y */
+    #pragma omp parallel for private(j, x, y)
+    for(i = 1; i < sizeC; i++)
+    {
+        double *up, *mid, *down;
+        x = i << 1;
+        up = fine[x-1];
+        mid = fine[x];
+        down = fine[x+1];
+        for(j = 1; j < sizeC; j++)
+        {
+            y = j << 1;
+            coarse[i][j] = mid[y]*0.25
+                + (up[y] + down[y] + mid[y-1] + mid[y+1]) * 0.125
+                + (up[y-1] + up[y+1] + down[y-1] + down[y+1]) * 0.0625;
+        }
+    }
+}
+
+/* Parallel interpolation function, interpolation is used to project values of a coarse grid onto a fine grid 
+This function is called to move up a level in the V-Cycle. Bilinear interpolation fused into one pass,
+each fine row is computed from the one or two coarse rows around it and every fine point is written once. */
+void interpolation(double** coarse, double** fine, int sizeFine, int sizeCoarse){
+    
+
+    int x, j;
+    int sizeF = sizeFine - 1;
+    int sizeC = sizeCoarse - 1;
+    /* launch parallel threads*/
+    #pragma omp parallel for private(j)
+    for(x = 1; x < sizeF; x++)
+    {
+        double *row = fine[x];
+        double *c0 = coarse[x >> 1];
+        double *c1 = coarse[(x + 1) >> 1];
+        double left, right;
+
+        /* fine rows on a coarse row copy it, the ones in between average the two coarse rows */
+        if((x & 1) == 0){
+            for(j = 0; j < sizeC; j++){
+                if(j > 0)
+                    row[j << 1] = c0[j];
+                row[(j << 1) + 1] = (c0[j] + c0[j+1]) * 0.5;
+            }
+        }
+        else{
+            left = (c0[0] + c1[0]) * 0.5;
+            for(j = 0; j < sizeC; j++){
+                right = (c0[j+1] + c1[j+1]) * 0.5;
+                if(j > 0)
+                    row[j << 1] = left;
+                row[(j << 1) + 1] = (left + right) * 0.5;
+                left = right;
+            }
+        }
+    }
+}
+
+/* Add the interpolated correction in t to u */
+void correct(level* l){
+    int i, j;
+    int interiorSize = l->size - 1;
+
+    #pragma omp parallel for private(j)
+    for(i = 1; i < interiorSize; i++){
+        for(j = 1; j < interiorSize; j++){
+            l->u[i][j] += l->t[i][j];
+        }
+    }
+}
+
+/* One V-cycle on level n with zero initial guess, the result is left in levels[n].u */
+void vcycle(int n){
+    int i;
+    level* l = &levels[n];
+    level* c = &levels[n+1];
+
+    for(i = 0; i < l->size; i++)
+        memset(l->u[i], 0, l->size*sizeof(double));
+
+    /* coarsest level reached, smooth until the error is small */
+    if(n == numLevels - 1){
+        smooth(l, COARSESWEEPS);
+        return;
+    }
+    /* presmooth and restrict the residual down to the coarse level */
+    smooth(l, SWEEPS);
+    residual(l);
+    restriction(l->t, c->f, c->size);
+
+    vcycle(n + 1);
+
+    /* interpolate the coarse correction back up and postsmooth */
+    interpolation(c->u, l->t, l->size, c->size);
+    correct(l);
+    smooth(l, SWEEPS);
+}
+
+/* Build the V-cycle levels below the fine grid, the fine right hand side is the residual r */
+void setupLevels(double** r){
+    int n = size - 2;
+
+    numLevels = 0;
+    while(numLevels < MAXLEVELS){
+        level* l = &levels[numLevels];
+        l->size = n + 2;
+        l->h2 = (numLevels == 0)? 1.0 : levels[numLevels-1].h2 * 4.0;
+        l->u = allocGrid(l->size);
+        l->f = (numLevels == 0)? r : allocGrid(l->size);
+        l->t = allocGrid(l->size);
+        numLevels++;
+        /* only odd interior sizes can be coarsened onto every other point */
+        if(n < 3 || n % 2 == 0)
+            break;
+        n = (n - 1) / 2;
+    }
+}
+
+void freeLevels(){
+    int n;
+    for(n = 0; n < numLevels; n++){
+        freeGrid(levels[n].u, levels[n].size);
+        if(n > 0)
+            freeGrid(levels[n].f, levels[n].size);
+        freeGrid(levels[n].t, levels[n].size);
+    }
+}
+
+/* Solve the grid with (preconditioned) conjugate gradient, returns the number of iterations used */
+int cg(double** x, double** r, double** rold, double** p, double** q, double* rmax){
+    int i, j, count;
+    int interiorSize = size - 1;
+    double** z = r;
+    double rz, rzNew, zrold, alpha, beta, rinit = 0.0;
+
+    /* the initial residual r = b - A x, the boundary values make up b */
+    #pragma omp parallel for private(j) reduction(max:rinit)
+    for(i = 1; i < interiorSize; i++){
+        for(j = 1; j < interiorSize; j++){
+            r[i][j] = (x[i-1][j] + x[i+1][j] + x[i][j-1] + x[i][j+1]) - 4.0*x[i][j];
+            if(fabs(r[i][j]) > rinit)
+                rinit = fabs(r[i][j]);
+        }
+    }
+    *rmax = rinit;
+    if(rinit < TOLERANCE)
+        return 0;
+
+    if(precond){
+        vcycle(0);
+        z = levels[0].u;
+    }
+    rz = dot(r, z);
+    direction(p, z, 0.0);
+
+    for(count = 1; count <= iters; count++)
+    {
+        alpha = rz / applyA(p, q);
+        *rmax = update(x, r, precond? rold : NULL, p, q, alpha);
+        if(*rmax < TOLERANCE)
+            break;
+
+        if(precond){
+            /* flexible CG, the V-cycle is not an exactly symmetric operator */
+            vcycle(0);
+            rzNew = dot(z, r);
+            zrold = dot(z, rold);
+            beta = (rzNew - zrold) / rz;
+        }
+        else{
+            rzNew = dot(r, r);
+            beta = rzNew / rz;
+        }
+        rz = rzNew;
+        direction(p, z, beta);
+    }
+    return (count > iters)? iters : count;
+}
+
+/* Function for printing the results of a grid to the output file */
+void print(double** a){
+    int i,j;
+    output = fopen("cg_parallel_matrix.txt","w");
+    for(i = 0; i < size; i++){
+        for(j = 0; j < size ; j++){
+            fprintf(output,"%g, ",a[i][j]);
+        }
+        fprintf(output,"\n");
+    }
+    fclose(output);
+}
+
+
+int main(int argc, char const *argv[])
+{
+    int i, j, used;
+    double rmax, **x, **r, **rold, **p, **q;
+
+    /* initialize input variables */
+    size = (argc > 1)? atoi(argv[1]) : MAXSIZE;
+    iters = (argc > 2)? atoi(argv[2]) : MAXITERS;
+    workers = (argc > 3)? atoi(argv[3]) : MAXWORKERS;
+    precond = (argc > 4)? atoi(argv[4]) : 1;
+    if(size > MAXSIZE) size = MAXSIZE;
+    if(iters > MAXITERS) iters = MAXITERS;
+    if(workers > MAXWORKERS) workers = MAXWORKERS;
+
+    /* set number of workers */
+    omp_set_num_threads(workers);
+
+    /* add the outer boundary points to the size of the interior grid */
+    size += 2;
+
+    /* the solution grid x holds the boundary, the CG vectors have zero boundaries */
+    x = allocGrid(size);
+    r = allocGrid(size);
+    rold = allocGrid(size);
+    p = allocGrid(size);
+    q = allocGrid(size);
+
+    /* init matrices, outer boundary points are = 1 and interior points are = 0 */
+    for(i = 0; i < size; i++){
+        for( j = 0; j < size; j++)
+        {
+            if(i == 0 || j == 0 || i == size-1 || j == size-1)
+                x[i][j] = 1;
+        }
+    }
+    if(precond)
+        setupLevels(r);
+
+    /* Beginning of computational part, read start time */
+    start_time = omp_get_wtime();
+
+    used = cg(x, r, rold, p, q, &rmax);
+
+    /* End of computational part, read the end time */
+    end_time = omp_get_wtime();
+
+    print(x);
+    printf("%d %d %d\t", size-2, iters, workers);
+    printf("%g\t", end_time - start_time);
+    printf("%d\t", used);
+    printf("%g\n", rmax);
+
+    if(precond)
+        freeLevels();
+    freeGrid(x, size);
+    freeGrid(r, size);
+    freeGrid(rold, size);
+    freeGrid(p, size);
+    freeGrid(q, size);
+
+    return 0;
+}
@@ -3,7 +3,14 @@
 
     usage with gcc (version 4.2 or higher required) and :
         gcc -O -fopenmp -o jacobi_parallel jacobi_parallel.c
-        ./jacobi_parallel size iters workers
+        ./jacobi_parallel size iters workers mode tolerance
+
+    mode = 0 runs with the configuration tuned for the grid size in jacobi_parallel.tune if there is one,
+    with the tuned number of threads only if no workers are given,
+    mode = 1 first autotunes schedule, chunk size, tile size and threads for the grid size and saves the result,
+    mode = 2 runs asynchronous jacobi, where threads update their strips in place without barriers.
+    With a tolerance above 0 the iterations stop early once the largest change is below it, and the
+    number of iterations used is printed before the max difference.
 
 */
 
@@ -15,6 +22,7 @@
 #include <math.h>
 #include <limits.h>
 #include <omp.h>
+#include <string.h>
 
 /* MAX for: Grid size, Number of Iterations and Working threads */
 
@@ -22,7 +30,37 @@
 #define MAXITERS 1000000
 #define MAXWORKERS 4
 
-int size, iters, workers;
+/* modes of the program, a normal run uses the tuned configuration for the grid size if there is one */
+#define RUN 0
+#define TUNE 1
+#define ASYNC 2
+
+/* with a tolerance, convergence is checked every CHECKEVERY iterations */
+#define CHECKEVERY 100
+
+/* the autotuner times TUNEITERS iterations per candidate, best of TUNEREPS, and caches the winner per grid size in TUNEFILE */
+#define TUNEFILE "jacobi_parallel.tune"
+#define TUNEITERS 20
+#define TUNEREPS 3
+#define SCHEDULES 3
+
+const omp_sched_t schedules[SCHEDULES] = {omp_sched_static, omp_sched_dynamic, omp_sched_guided};
+const char* scheduleNames[SCHEDULES] = {"static", "dynamic", "guided"};
+/* candidate chunk sizes (0 is the default of the schedule) and tile sizes (0 is the untiled loop) */
+const int chunks[] = {0, 1, 4, 16, 64};
+const int tiles[] = {0, 16, 64, 256};
+
+/* the last change published by a thread and how many times it has published, padded to its own cache line */
+typedef struct{
+    double value;
+    long checks;
+    char pad[64 - sizeof(double) - sizeof(long)];
+} slot;
+
+int size, iters, workers, mode;
+double tolerance;
+omp_sched_t schedule = omp_sched_static;
+int chunk, tileI, tileJ;
 double maxdiff;
 double start_time, end_time;
 FILE* output;
@@ -49,35 +87,313 @@ void maxDiff(double** a, double** b){
 }
 
 /* Parallelized Jacobi Method function that iterates over the grids a & b updating their values
-over a number of iterations. 
+over a number of iterations. The loops run over tiles of tileI x tileJ points (tileI = 0 is one row,
+tileJ = 0 is the whole row), and are scheduled with the runtime schedule set by the tuned configuration.
 */
-void jacobi(double** a, double** b){
-    int i, j, count;
+void jacobi(double** a, double** b, int iterations){
+    int i, j, ti, tj, count;
     int interiorSize = size - 1;
+    int rows = (tileI > 0)? tileI : 1;
+    int cols = (tileJ > 0)? tileJ : interiorSize;
 
-    for(count = 0; count < iters; count++)
+    for(count = 0; count < iterations; count++)
     {
         /* launch threads */
-        #pragma omp parallel
+        #pragma omp parallel private(i, j)
         {
             /* Update all the values in grid b */
-            #pragma omp for private(j)
-            for(i = 1; i < interiorSize; i++){
-                for(j = 1; j < interiorSize; j++){
-                    b[i][j] = (a[i-1][j] + a[i+1][j] + a[i][j-1] +a[i][j+1])* 0.25;
+            #pragma omp for collapse(2) schedule(runtime)
+            for(ti = 1; ti < interiorSize; ti += rows){
+                for(tj = 1; tj < interiorSize; tj += cols){
+                    for(i = ti; i < ti + rows && i < interiorSize; i++){
+                        for(j = tj; j < tj + cols && j < interiorSize; j++){
+                            b[i][j] = (a[i-1][j] + a[i+1][j] + a[i][j-1] +a[i][j+1])* 0.25;
+                        }
+                    }
                 }   
             }
             /* Update all the values in grid a*/
-            #pragma omp for private(j)
-            for(i = 1; i < interiorSize; i++){
-                for(j = 1; j < interiorSize; j++){
-                    a[i][j] = (b[i-1][j] + b[i+1][j] + b[i][j-1] +b[i][j+1])*0.25;
+            #pragma omp for collapse(2) schedule(runtime)
+            for(ti = 1; ti < interiorSize; ti += rows){
+                for(tj = 1; tj < interiorSize; tj += cols){
+                    for(i = ti; i < ti + rows && i < interiorSize; i++){
+                        for(j = tj; j < tj + cols && j < interiorSize; j++){
+                            a[i][j] = (b[i-1][j] + b[i+1][j] + b[i][j-1] +b[i][j+1])*0.25;
+                        }
+                    }
                 }   
             }
         }
     }   
 }
 
+/* Set the schedule, chunk size, tiles and threads used by jacobi */
+void applyConfig(omp_sched_t kind, int chunkSize, int tileRows, int tileCols, int threads){
+    schedule = kind;
+    chunk = chunkSize;
+    tileI = tileRows;
+    tileJ = tileCols;
+    workers = threads;
+    omp_set_schedule(schedule, chunk);
+    omp_set_num_threads(workers);
+}
+
+/* Time TUNEITERS jacobi iterations with the current configuration, best of TUNEREPS runs */
+double timeConfig(double** a, double** b){
+    int rep;
+    double t, best = 0.0;
+
+    for(rep = 0; rep < TUNEREPS; rep++){
+        t = omp_get_wtime();
+        jacobi(a, b, TUNEITERS);
+        t = omp_get_wtime() - t;
+        if(rep == 0 || t < best)
+            best = t;
+    }
+    return best;
+}
+
+/* Read the tuning file and apply the configuration stored for this grid size, returns false if there is none.
+The tuned number of threads is only used if keepWorkers is false, so workers given on the command line stay */
+bool loadConfig(bool keepWorkers){
+    char name[16];
+    int s, c, ti, tj, t, k;
+    double time;
+    bool found = false;
+    FILE* tuning = fopen(TUNEFILE, "r");
+
+    if(tuning == NULL)
+        return false;
+    while(fscanf(tuning, "%d %15s %d %d %d %d %lf", &s, name, &c, &ti, &tj, &t, &time) == 7){
+        if(s != size - 2)
+            continue;
+        for(k = 0; k < SCHEDULES; k++){
+            if(strcmp(name, scheduleNames[k]) == 0){
+                applyConfig(schedules[k], c, ti, tj, keepWorkers? workers : (t < MAXWORKERS)? t : MAXWORKERS);
+                found = true;
+            }
+        }
+    }
+    fclose(tuning);
+    return found;
+}
+
+/* Write the current configuration to the tuning file, replacing any earlier line for this grid size */
+void saveConfig(double time){
+    char line[256];
+    int s, k;
+    FILE* tuning = fopen(TUNEFILE, "r");
+    FILE* updated = fopen(TUNEFILE ".tmp", "w");
+
+    if(updated == NULL)
+        return;
+    if(tuning != NULL){
+        while(fgets(line, sizeof(line), tuning) != NULL){
+            if(sscanf(line, "%d", &s) == 1 && s != size - 2)
+                fputs(line, updated);
+        }
+        fclose(tuning);
+    }
+    for(k = 0; k < SCHEDULES; k++){
+        if(schedules[k] == schedule)
+            fprintf(updated, "%d %s %d %d %d %d %g\n", size - 2, scheduleNames[k], chunk, tileI, tileJ, workers, time);
+    }
+    fclose(updated);
+    rename(TUNEFILE ".tmp", TUNEFILE);
+}
+
+/* Autotuner, searches the configuration one parameter at a time: schedule and chunk size with all workers,
+then tile sizes, then the number of threads. Every candidate keeps the best values found so far for the
+other parameters. The winner is applied and saved to the tuning file. */
+void tune(double** a, double** b){
+    int k, c, ti, tj, t;
+    int maxWorkers = workers;
+    double time, best;
+    omp_sched_t bestKind = omp_sched_static;
+    int bestChunk = 0, bestI = 0, bestJ = 0, bestThreads = maxWorkers;
+
+    applyConfig(bestKind, bestChunk, bestI, bestJ, bestThreads);
+    best = timeConfig(a, b);
+
+    for(k = 0; k < SCHEDULES; k++){
+        for(c = 0; c < (int)(sizeof(chunks)/sizeof(chunks[0])); c++){
+            applyConfig(schedules[k], chunks[c], bestI, bestJ, bestThreads);
+            time = timeConfig(a, b);
+            if(time < best){
+                best = time;
+                bestKind = schedules[k];
+                bestChunk = chunks[c];
+            }
+        }
+    }
+    for(ti = 0; ti < (int)(sizeof(tiles)/sizeof(tiles[0])); ti++){
+        for(tj = 0; tj < (int)(sizeof(tiles)/sizeof(tiles[0])); tj++){
+            applyConfig(bestKind, bestChunk, tiles[ti], tiles[tj], bestThreads);
+            time = timeConfig(a, b);
+            if(time < best){
+                best = time;
+                bestI = tiles[ti];
+                bestJ = tiles[tj];
+            }
+        }
+    }
+    for(t = 1; t < maxWorkers; t++){
+        applyConfig(bestKind, bestChunk, bestI, bestJ, t);
+        time = timeConfig(a, b);
+        if(time < best){
+            best = time;
+            bestThreads = t;
+        }
+    }
+
+    applyConfig(bestKind, bestChunk, bestI, bestJ, bestThreads);
+    saveConfig(best);
+}
+
+/* Asynchronous (chaotic) relaxation, every thread updates its own strip of rows of grid a in place, without
+any barriers, reading whatever values its neighbours have written so far. Every CHECKEVERY sweeps a thread
+publishes the largest change over those sweeps. When a thread sees every published change below the tolerance,
+it waits (still sweeping) until every thread has published again, and if all changes are still below the tolerance
+all threads stop. This only says the threads look converged, the sweeps need not have read the newest edge rows
+of their neighbours, so jacobiAsync checks the grid before it is accepted. The rows on the edges of a strip are
+shared with the neighbour strips and are read and written atomically. Returns the largest number of sweeps done
+by a thread. */
+int asyncSweeps(double** a, int iterations, double tolerance){
+    int interiorSize = size - 1;
+    int done = 0, used = 0;
+    slot changes[MAXWORKERS];
+
+    for(int t = 0; t < MAXWORKERS; t++){
+        changes[t].value = -1.0;
+        changes[t].checks = 0;
+    }
+
+    #pragma omp parallel
+    {
+        int i, j, t, count, stop, candidate = 0;
+        long checks, seen[MAXWORKERS];
+        int id = omp_get_thread_num();
+        int threads = omp_get_num_threads();
+        /* rows first to last are the strip of this thread */
+        int first = 1 + (interiorSize - 1) * id / threads;
+        int last = (interiorSize - 1) * (id + 1) / threads;
+        double change = 0.0, window = 0.0, value, up, down, published;
+
+        for(count = 0; count < iterations; count++)
+        {
+            change = 0.0;
+            for(i = first; i <= last; i++){
+                if(i == first || i == last){
+                    for(j = 1; j < interiorSize; j++){
+                        #pragma omp atomic read
+                        up = a[i-1][j];
+                        #pragma omp atomic read
+                        down = a[i+1][j];
+                        value = (up + down + a[i][j-1] + a[i][j+1]) * 0.25;
+                        if(fabs(value - a[i][j]) > change)
+                            change = fabs(value - a[i][j]);
+                        #pragma omp atomic write
+                        a[i][j] = value;
+                    }
+                }
+                else{
+                    for(j = 1; j < interiorSize; j++){
+                        value = (a[i-1][j] + a[i+1][j] + a[i][j-1] + a[i][j+1]) * 0.25;
+                        if(fabs(value - a[i][j]) > change)
+                            change = fabs(value - a[i][j]);
+                        a[i][j] = value;
+                    }
+                }
+            }
+
+            /* periodic global convergence check, no thread waits for the others */
+            if(change > window)
+                window = change;
+            if(tolerance > 0 && count % CHECKEVERY == CHECKEVERY - 1){
+                #pragma omp atomic write
+                changes[id].value = window;
+                window = 0.0;
+                #pragma omp atomic update
+                changes[id].checks++;
+                stop = 1;
+                for(t = 0; t < threads; t++){
+                    #pragma omp atomic read
+                    published = changes[t].value;
+                    #pragma omp atomic read
+                    checks = changes[t].checks;
+                    if(published < 0 || published >= tolerance)
+                        stop = candidate = 0;
+                    /* in the second round every thread must have published since the first */
+                    else if(candidate && checks <= seen[t])
+                        stop = 0;
+                    if(!candidate)
+                        seen[t] = checks;
+                }
+                if(stop && candidate){
+                    #pragma omp atomic write
+                    done = 1;
+                }
+                else if(stop)
+                    candidate = 1;
+            }
+            #pragma omp atomic read
+            stop = done;
+            if(stop){
+                count++;
+                break;
+            }
+        }
+        #pragma omp critical
+        if(count > used)
+            used = count;
+    }
+    return used;
+}
+
+/* The largest change one synchronous jacobi sweep would make to grid a, which is left as it is */
+double sweepChange(double** a){
+    int i, j;
+    double change = 0.0, value;
+
+    #pragma omp parallel for private(j, value) reduction(max:change)
+    for(i = 1; i < size - 1; i++){
+        for(j = 1; j < size - 1; j++){
+            value = (a[i-1][j] + a[i+1][j] + a[i][j-1] + a[i][j+1]) * 0.25;
+            if(fabs(value - a[i][j]) > change)
+                change = fabs(value - a[i][j]);
+        }
+    }
+    return change;
+}
+
+/* Asynchronous relaxation until a synchronous sweep over the grid changes it by less than the tolerance,
+so convergence never rests on stale edge rows. If it does not, the threads go on sweeping. Returns the number
+of sweeps used, the change of the last check ends up in maxdiff. */
+int jacobiAsync(double** a, int iterations, double tolerance){
+    int used = 0;
+
+    do{
+        used += asyncSweeps(a, iterations - used, tolerance);
+        maxdiff = sweepChange(a);
+    } while(tolerance > 0 && maxdiff >= tolerance && used < iterations);
+    return used;
+}
+
+/* Synchronous jacobi until the max difference between a & b is below the tolerance, checked every CHECKEVERY iterations */
+int jacobiTolerance(double** a, double** b, int iterations, double tolerance){
+    int count = 0;
+
+    while(count < iterations){
+        jacobi(a, b, (iterations - count < CHECKEVERY)? iterations - count : CHECKEVERY);
+        count += (iterations - count < CHECKEVERY)? iterations - count : CHECKEVERY;
+        maxdiff = 0.0;
+        maxDiff(a, b);
+        if(maxdiff < tolerance)
+            break;
+    }
+    return count;
+}
+
 /* Function for printing the results of a grid to the output file */
 void print(double** a){
     int i,j;
@@ -95,20 +411,23 @@ void print(double** a){
 
 int main(int argc, char const *argv[])
 {
-    int i,j;
+    int i,j, used;
     maxdiff = 0.0;
 
     /* initialize input variables */
     size = (argc > 1)? atoi(argv[1]) : MAXSIZE;
     iters = (argc > 2)? atoi(argv[2]) : MAXITERS;
     workers = (argc > 3)? atoi(argv[3]) : MAXWORKERS;
+    mode = (argc > 4)? atoi(argv[4]) : RUN;
+    tolerance = (argc > 5)? atof(argv[5]) : 0.0;
     if(size > MAXSIZE) size = MAXSIZE; 
     if(iters > MAXITERS) iters = MAXITERS;
     if(workers > MAXWORKERS) workers = MAXWORKERS;
+    used = iters;
 
    
-    /* set number of workers */
-    omp_set_num_threads(workers);
+    /* set number of workers and the default schedule */
+    applyConfig(omp_sched_static, 0, 0, 0, workers);
 
     /* The specified input variable: Size, is defined as the size of the interior grid.
     By adding 2 to this size the total size of the grid is retrieve, including outer boundary points 
@@ -139,14 +458,41 @@ int main(int argc, char const *argv[])
             }
         }
     }
+    /* pick the schedule, tiles and threads, tuning on a copy of the grids so the run below starts from the initial values */
+    if(mode == TUNE){
+        double** ta = malloc(size*sizeof(double*));
+        double** tb = malloc(size*sizeof(double*));
+        for(i = 0; i < size; i++){
+            ta[i] = malloc(size*sizeof(double));
+            tb[i] = malloc(size*sizeof(double));
+            memcpy(ta[i], a[i], size*sizeof(double));
+            memcpy(tb[i], b[i], size*sizeof(double));
+        }
+        tune(ta, tb);
+        for(i = 0; i < size; i++){
+            free(ta[i]);
+            free(tb[i]);
+        }
+        free(ta);
+        free(tb);
+    }
+    else if(mode == RUN)
+        loadConfig(argc > 3);
+
     /* Beginning of computational part, read start time */
     start_time = omp_get_wtime();
 
 
-    /* Jacobi iteration between a & b*/
-    jacobi(a, b);
-    /* Calculate max difference error between a & b*/
-    maxDiff(a,b);
+    /* Jacobi iteration between a & b, or in place on a in asynchronous mode */
+    if(mode == ASYNC)
+        used = jacobiAsync(a, iters, tolerance);
+    else if(tolerance > 0)
+        used = jacobiTolerance(a, b, iters, tolerance);
+    else{
+        jacobi(a, b, iters);
+        /* Calculate max difference error between a & b*/
+        maxDiff(a,b);
+    }
 
     /* End of computational part, read the end time */
     end_time = omp_get_wtime();
@@ -155,6 +501,8 @@ int main(int argc, char const *argv[])
     print(a);
     printf("%d %d %d\t", size-2, iters, workers);
     printf("%g\t", end_time - start_time);
+    if(tolerance > 0)
+        printf("%d\t", used);
     printf("%g\n", maxdiff);
     free(a);
     free(b);
@@ -2,8 +2,10 @@
     @Author Jakob Berggren, Oskar Hahr
 
     usage with gcc (version 4.2 or higher required) and :
-        gcc -O -fopenmp -o multigrid_parallel multigrid_parallel.c
-        ./multigrid_parallel size iters workers
+        gcc -O -fopenmp -o multigrid_parallel multigrid_parallel.c -lm
+        ./multigrid_parallel size iters workers smoother
+
+    smoother = 0 smooths with plain jacobi sweeps, smoother = 1 with the Chebyshev smoother
 */
 
 #include <omp.h>
@@ -18,12 +20,103 @@
 /* MAX numbers for grid size, number of iterations and workers */
 #define MAXSIZE 1000
 #define MAXITERS 10000000
+
 #define MAXWORKERS 4
 
-int iters, workers;
+/* largest coarsest grid, in interior points per side, that is solved directly. Measured with the profile
+build on one core, the direct solve takes as long as about 170 coarse jacobi sweeps at 24, 480 at 32,
+1500 at 64 and 6000 at 128 (0.36 s). Jacobi needs on the order of n^2 sweeps to converge, so the direct
+solve pays off up to about 32, above it it costs more than the coarse sweeps a V-Cycle usually gets */
+#define DIRECTMAX 32
+
+/* smoother option for the jacobi sweeps on the way down and up the V-Cycle */
+#define JACOBI 0
+#define CHEBYSHEV 1
+#define POWERITERS 10
+
+int iters, workers, smoother;
 double start_time, end_time, maxdiff;
 FILE* output;
 
+/* Instrumentation of the V-Cycle, compiled in with -DPROFILE. Every call in the V-Cycle is timed per level
+and phase, and the bytes moved and flops done are counted from a simple model of each kernel. The summary is
+written as csv to multigrid_parallel_profile.csv. Without PROFILE the TIMED macro is just the call. */
+#define SMOOTH 0
+#define RESTRICT 1
+#define INTERPOLATE 2
+#define MAXDIFF 3
+#define PHASES 4
+#define LEVELS 4
+
+#ifdef PROFILE
+typedef struct{
+    int size, calls, sweeps;
+    double time, bytes, flops;
+} counter;
+
+counter counters[LEVELS][PHASES];
+const char* phaseNames[PHASES] = {"smooth", "restrict", "interpolate", "maxdiff"};
+
+/* Count one call of a phase on a level (1 is the coarsest), size is the grid size the kernel writes */
+void profileAdd(int level, int phase, int sweeps, int size, double time){
+    counter* c = &counters[level-1][phase];
+    double points = (double)(size - 2) * (size - 2);
+
+    /* bytes and flops per point: a jacobi half sweep streams one grid in and one out with 4 flops,
+    a Chebyshev half sweep also reads the grid it writes and does 10 flops. Restriction reads the 4 fine points
+    under each coarse point, interpolation reads a quarter coarse point per fine point and maxDiff reads two grids. */
+    switch(phase){
+        case SMOOTH:
+            if(smoother == CHEBYSHEV && level > 1){
+                c->bytes += 2.0 * sweeps * points * 24;
+                c->flops += 2.0 * sweeps * points * 10;
+            }
+            else{
+                c->bytes += 2.0 * sweeps * points * 16;
+                c->flops += 2.0 * sweeps * points * 4;
+            }
+            break;
+        case RESTRICT:
+            c->bytes += points * 40;
+            c->flops += points * 17;
+            break;
+        case INTERPOLATE:
+            c->bytes += points * 10;
+            c->flops += points * 1.25;
+            break;
+        case MAXDIFF:
+            c->bytes += points * 16;
+            c->flops += points * 2;
+            break;
+    }
+    c->size = size;
+    c->calls++;
+    c->sweeps += sweeps;
+    c->time += time;
+}
+
+void profilePrint(){
+    int l, p;
+    FILE* csv = fopen("multigrid_parallel_profile.csv", "w");
+
+    fprintf(csv, "level,size,phase,calls,sweeps,seconds,bytes,GB/s,GFLOP/s\n");
+    for(l = 0; l < LEVELS; l++){
+        for(p = 0; p < PHASES; p++){
+            counter* c = &counters[l][p];
+            if(c->calls == 0)
+                continue;
+            fprintf(csv, "%d,%d,%s,%d,%d,%g,%g,%g,%g\n", l+1, c->size, phaseNames[p], c->calls, c->sweeps, c->time,
+                c->bytes, (c->time > 0)? c->bytes / c->time * 1e-9 : 0.0, (c->time > 0)? c->flops / c->time * 1e-9 : 0.0);
+        }
+    }
+    fclose(csv);
+}
+
+#define TIMED(level, phase, sweeps, size, call) do{ double t0 = omp_get_wtime(); call; profileAdd(level, phase, sweeps, size, omp_get_wtime() - t0); }while(0)
+#else
+#define TIMED(level, phase, sweeps, size, call) call
+#endif
+
 /* Iterative parallel function for calculating the max difference between grids a & b with the size of size */
 void maxDiff(double** a, double** b, int size){
     int i, j;
@@ -49,36 +142,196 @@ void maxDiff(double** a, double** b, int size){
     }
 }
 /* An iterative Jacobi Method function that iterates over the grids a & b updating their values
-over a number of iterations. */
-void jacobi(double** a, double** b, int size, int iterations){
+over a number of iterations. If lmax is above zero, the sweeps are accelerated as a Chebyshev
+polynomial smoother that damps the error over [lmax/4, lmax] of the jacobi preconditioned operator.
+The Chebyshev weights only depend on the sweep number, so no reductions are needed in the sweeps. */
+void jacobi(double** a, double** b, int size, int iterations, double lmax){
     int interiorSize = size - 1;
-    /* launch parallel threads */
     int count = 0;
-        /* initialize private variables */
-        int id = omp_get_thread_num();
+    /* damping tau maps [lmax/4, lmax] onto [-rho, rho] of the damped jacobi iteration matrix */
+    double tau = (lmax > 0)? 2.0 / (1.25 * lmax) : 1.0;
+    double rho = 0.6;
+    double omega = 1.0, w1 = 0.0, w2 = 0.0;
+
         for(count = 0; count < iterations; count++)
         {   
-            /* First for loop to calculate new values of grid b */
+            /* Chebyshev weights of the two half sweeps, the grid written to holds the iterate before the one read */
+            if(lmax > 0){
+                w1 = omega = (count == 0)? 1.0 : 1.0 / (1.0 - rho*rho*omega*0.25);
+                w2 = omega = (count == 0)? 2.0 / (2.0 - rho*rho) : 1.0 / (1.0 - rho*rho*omega*0.25);
+            }
+            /* launch parallel threads */
             #pragma omp parallel
             {
             int i,j;
-            #pragma omp for
-            for(i = 1; i < interiorSize; i++){
-                for(j = 1; j < interiorSize; j++){
-                b[i][j] = (a[i-1][j] + a[i+1][j] + a[i][j-1] +a[i][j+1]) * 0.25;
-                }   
+            if(lmax > 0){
+                /* Chebyshev half sweeps from a to b and from b to a */
+                #pragma omp for
+                for(i = 1; i < interiorSize; i++){
+                    for(j = 1; j < interiorSize; j++){
+                        b[i][j] += w1 * (a[i][j] + tau*((a[i-1][j] + a[i+1][j] + a[i][j-1] + a[i][j+1]) * 0.25 - a[i][j]) - b[i][j]);
+                    }
+                }
+                #pragma omp for
+                for(i = 1; i < interiorSize; i++){
+                    for(j = 1; j < interiorSize; j++){
+                        a[i][j] += w2 * (b[i][j] + tau*((b[i-1][j] + b[i+1][j] + b[i][j-1] + b[i][j+1]) * 0.25 - b[i][j]) - a[i][j]);
+                    }
+                }
+            }
+            else{
+                /* First for loop to calculate new values of grid b */
+                #pragma omp for
+                for(i = 1; i < interiorSize; i++){
+                    for(j = 1; j < interiorSize; j++){
+                    b[i][j] = (a[i-1][j] + a[i+1][j] + a[i][j-1] +a[i][j+1]) * 0.25;
+                    }   
+                }
+                /* Second for loop to calculate new values of grid a */
+                #pragma omp for
+                for(i = 1; i < interiorSize; i++){
+                    for(j = 1; j < interiorSize; j++){
+                        a[i][j] = (b[i-1][j] + b[i+1][j] + b[i][j-1] +b[i][j+1])*0.25;
+                    }   
+                }  
             }
-            /* Second for loop to calculate new values of grid a */
-            #pragma omp for
-            for(i = 1; i < interiorSize; i++){
-                for(j = 1; j < interiorSize; j++){
-                    a[i][j] = (b[i-1][j] + b[i+1][j] + b[i][j-1] +b[i][j+1])*0.25;
-                }   
-            }  
         }  
     } 
 }
 
+/* Estimate the largest eigenvalue of the jacobi preconditioned operator I - J on a grid of the given size
+with a few power iterations. Used once at setup for the Chebyshev smoother, the estimate is padded
+by 10% and capped with the Gershgorin bound 2. */
+double estimateLambda(int size){
+    int i, j, count;
+    int interiorSize = size - 1;
+    double norm, lmax = 0.0;
+    double** x = malloc(size*sizeof(double*));
+    double** y = malloc(size*sizeof(double*));
+
+    for(i = 0; i < size; i++){
+        x[i] = calloc(size, sizeof(double));
+        y[i] = calloc(size, sizeof(double));
+    }
+    /* start from the checkerboard, it is closest to the most oscillating mode */
+    for(i = 1; i < interiorSize; i++)
+        for(j = 1; j < interiorSize; j++)
+            x[i][j] = ((i + j) & 1)? -1.0 : 1.0;
+
+    for(count = 0; count < POWERITERS; count++){
+        norm = 0.0;
+        #pragma omp parallel for private(j) reduction(max:norm)
+        for(i = 1; i < interiorSize; i++){
+            for(j = 1; j < interiorSize; j++){
+                y[i][j] = x[i][j] - (x[i-1][j] + x[i+1][j] + x[i][j-1] + x[i][j+1]) * 0.25;
+                if(fabs(y[i][j]) > norm)
+                    norm = fabs(y[i][j]);
+            }
+        }
+        lmax = norm;
+        /* normalize y back into x, x had max norm 1 */
+        #pragma omp parallel for private(j)
+        for(i = 1; i < interiorSize; i++)
+            for(j = 1; j < interiorSize; j++)
+                x[i][j] = y[i][j] / norm;
+    }
+
+    for(i = 0; i < size; i++){
+        free(x[i]);
+        free(y[i]);
+    }
+    free(x);
+    free(y);
+
+    lmax *= 1.1;
+    return (lmax > 2.0)? 2.0 : lmax;
+}
+
+
+/* Coarsest grids with at most DIRECTMAX interior points per side are solved directly with a banded
+Cholesky factorization of the 5-point matrix A = 4I - neighbours. The factorization
+costs about n^4 flops and the two substitutions about 4 n^3. It is computed inside the
+timed solve, and the program solves only once. Larger coarse grids fall back to jacobi iterations. */
+double* factor = NULL;
+
+/* Banded Cholesky factorization A = L L^T on an n x n interior grid. Row k of L holds the n+1 entries
+from column k-n to k, entry (k, c) is stored at factor[k*(n+1) + c - k + n] */
+void factorize(int n){
+    int k, c, m, first;
+    int N = n*n, w = n + 1;
+    double sum;
+
+    free(factor);
+    factor = calloc((size_t)N*w, sizeof(double));
+    for(k = 0; k < N; k++){
+        first = (k > n)? k - n : 0;
+        for(c = first; c <= k; c++){
+            /* entry A[k][c] of the 5-point matrix, points are numbered row by row */
+            if(c == k)
+                sum = 4.0;
+            else if(c == k - n || (c == k - 1 && k % n != 0))
+                sum = -1.0;
+            else
+                sum = 0.0;
+            for(m = (c > n)? c - n : first; m < c; m++){
+                if(m >= first)
+                    sum -= factor[k*w + m - k + n] * factor[c*w + m - c + n];
+            }
+            if(c == k)
+                factor[k*w + n] = sqrt(sum);
+            else
+                factor[k*w + c - k + n] = sum / factor[c*w + n];
+        }
+    }
+}
+
+/* Solve the coarsest grid a, the boundary values of a make up the right hand side. b gets the same solution
+so the two grids agree as after converged jacobi iterations */
+void coarseSolve(double** a, double** b, int size, int iterations){
+    int i, j, k, m, first, last;
+    int n = size - 2, N = n*n, w = n + 1;
+    double sum, *x;
+
+    if(n > DIRECTMAX){
+        jacobi(a, b, size, iterations, 0.0);
+        return;
+    }
+    factorize(n);
+
+    /* right hand side, the boundary neighbours of every interior point */
+    x = malloc(N*sizeof(double));
+    for(i = 1; i <= n; i++){
+        for(j = 1; j <= n; j++){
+            sum = 0.0;
+            if(i == 1) sum += a[0][j];
+            if(i == n) sum += a[n+1][j];
+            if(j == 1) sum += a[i][0];
+            if(j == n) sum += a[i][n+1];
+            x[(i-1)*n + j-1] = sum;
+        }
+    }
+    /* forward substitution L y = b, then back substitution L^T x = y */
+    for(k = 0; k < N; k++){
+        first = (k > n)? k - n : 0;
+        for(m = first; m < k; m++)
+            x[k] -= factor[k*w + m - k + n] * x[m];
+        x[k] /= factor[k*w + n];
+    }
+    for(k = N - 1; k >= 0; k--){
+        last = (k + n < N)? k + n : N - 1;
+        for(m = k + 1; m <= last; m++)
+            x[k] -= factor[m*w + k - m + n] * x[m];
+        x[k] /= factor[k*w + n];
+    }
+
+    for(i = 1; i <= n; i++){
+        for(j = 1; j <= n; j++){
+            a[i][j] = x[(i-1)*n + j-1];
+            b[i][j] = a[i][j];
+        }
+    }
+    free(x);
+}
 
 void print(double** a, int s){
     int i,j;
@@ -94,7 +347,8 @@ void print(double** a, int s){
 }
 
 /* Parallel restriction function, the restriction function is used to project the values of a fine grid onto a coarse grid. 
-This function is used to down a level in the V-Cycle */
+This function is used to down a level in the V-Cycle. Full weighting over the 9 fine points around each coarse point,
+each coarse point is written once in a single pass over the fine grid. */
 void restriction(double** fine, double** coarse, int size){
 
     int i, j, x, y;
@@ -103,49 +357,55 @@ void restriction(double** fine, double** coarse, int size){
     #pragma omp parallel for private(j, x, y)
     for(i = 1; i < sizeC; i++)
     {
+        double *up, *mid, *down;
         x = i << 1;
+        up = fine[x-1];
+        mid = fine[x];
+        down = fine[x+1];
         for(j = 1; j < sizeC; j++)
         {
             y = j << 1;
-            coarse[i][j] = fine[x][y]*0.5 + (fine[x-1][y] + fine[x][y-1] + fine[x][y + 1] + fine[x + 1][y]) * 0.125;
+            coarse[i][j] = mid[y]*0.25
+                + (up[y] + down[y] + mid[y-1] + mid[y+1]) * 0.125
+                + (up[y-1] + up[y+1] + down[y-1] + down[y+1]) * 0.0625;
         }
     }
 }
 
 /* Parallel interpolation function, interpolation is used to project values of a coarse grid onto a fine grid 
-This function is called to move up a level in the V-Cycle */
+This function is called to move up a level in the V-Cycle. Bilinear interpolation fused into one pass,
+each fine row is computed from the one or two coarse rows around it and every fine point is written once. */
 void interpolation(double** coarse, double** fine, int sizeFine, int sizeCoarse){
     
 
-    int i, j, x, y;
+    int x, j;
     int sizeF = sizeFine - 1;
     int sizeC = sizeCoarse - 1;
     /* launch parallel threads*/
-    #pragma omp parallel
+    #pragma omp parallel for private(j)
+    for(x = 1; x < sizeF; x++)
     {
-        /* Update the fine points that directly map to a coarse point in the grid */
-        #pragma omp for private(j, x, y)
-        for(i = 1; i < sizeC; i++)
-        {
-            x = i << 1;
-            for(j = 1; j < sizeC; j++)
-            {
-                y = j << 1;
-                fine[x][y] = coarse[i][j]; 
-            }
-        }
-        /* Update the fine points that are in the same columns as a coarse point in the grid */
-        #pragma omp for private(j, x, y)
-        for(i = 1; i < sizeF; i += 2){
-            for(j = 2; j < sizeF; j += 2){
-                fine[i][j] = (fine[i-1][j] + fine[i+1][j]) * 0.5; 
+        double *row = fine[x];
+        double *c0 = coarse[x >> 1];
+        double *c1 = coarse[(x + 1) >> 1];
+        double left, right;
+
+        /* fine rows on a coarse row copy it, the ones in between average the two coarse rows */
+        if((x & 1) == 0){
+            for(j = 0; j < sizeC; j++){
+                if(j > 0)
+                    row[j << 1] = c0[j];
+                row[(j << 1) + 1] = (c0[j] + c0[j+1]) * 0.5;
             }
         }
-        /* Update the rest of the fine points in the grid. */
-        #pragma omp for private(j, x, y)
-        for(i = 1; i < sizeF; i++){
-            for(j = 1; j < sizeF; j += 2){
-                fine[i][j] = (fine[i][j-1] + fine[i][j+1]) * 0.5;
+        else{
+            left = (c0[0] + c1[0]) * 0.5;
+            for(j = 0; j < sizeC; j++){
+                right = (c0[j+1] + c1[j+1]) * 0.5;
+                if(j > 0)
+                    row[j << 1] = left;
+                row[(j << 1) + 1] = (left + right) * 0.5;
+                left = right;
             }
         }
     }
@@ -156,12 +416,14 @@ void interpolation(double** coarse, double** fine, int sizeFine, int sizeCoarse)
 int main(int argc, char const *argv[])
 {
     int i,j, size1, size2, size3, size4;
-    double maxdiff, **a1, **a2, **a3, **a4, **b1, **b2, **b3, **b4;
+    double lmax2, lmax3, lmax4;
+    double **a1, **a2, **a3, **a4, **b1, **b2, **b3, **b4;
     
     /* initialize input variables */
     size1 = (argc > 1)? atoi(argv[1]) : MAXSIZE;
     iters = (argc > 2)? atoi(argv[2]) : MAXITERS;
     workers = (argc > 3)? atoi(argv[3]) : MAXWORKERS;
+    smoother = (argc > 4)? atoi(argv[4]) : JACOBI;
     if(size1 > MAXSIZE) size1 = MAXSIZE; 
     if(iters > MAXITERS) iters = MAXITERS;
     if(workers > MAXWORKERS) workers = MAXWORKERS;
@@ -281,41 +543,52 @@ int main(int argc, char const *argv[])
         }
     }
 
+    /* setup for the Chebyshev smoother, estimate the eigenvalue bounds on each smoothed level once */
+    lmax2 = lmax3 = lmax4 = 0.0;
+    if(smoother == CHEBYSHEV){
+        lmax2 = estimateLambda(size2);
+        lmax3 = estimateLambda(size3);
+        lmax4 = estimateLambda(size4);
+    }
+
     /* computational part, take start time */
     start_time = omp_get_wtime();
 
     /* begin V-Cycle at the top level, restrict down to the coarsest level
     while doing 4 jacobi iterations on each level. */
-    jacobi(a4, b4, size4, 4);
-    restriction(a4, a3, size3);
+    TIMED(4, SMOOTH, 4, size4, jacobi(a4, b4, size4, 4, lmax4));
+    TIMED(3, RESTRICT, 0, size3, restriction(a4, a3, size3));
 
-    jacobi(a3, b3, size3, 4);
-    restriction(a3, a2, size2);
+    TIMED(3, SMOOTH, 4, size3, jacobi(a3, b3, size3, 4, lmax3));
+    TIMED(2, RESTRICT, 0, size2, restriction(a3, a2, size2));
 
-    jacobi(a2, b2, size2, 4);
-    restriction(a2, a1, size1);
+    TIMED(2, SMOOTH, 4, size2, jacobi(a2, b2, size2, 4, lmax2));
+    TIMED(1, RESTRICT, 0, size1, restriction(a2, a1, size1));
 
-    /* Coarsest level reached. Perform iters number of jacobi iterations 
-    defined as input argument, and start interpolating back up to the finest grain level. 
+    /* Coarsest level reached. Solve it directly if it is small enough, otherwise perform iters number of jacobi
+    iterations defined as input argument, and start interpolating back up to the finest grain level. 
     One the way up, perform 4 jacobi iterations on each level. */
-    jacobi(a1, b1, size1, iters);
-    interpolation(a1, a2, size2, size1);
+    TIMED(1, SMOOTH, (size1 - 2 > DIRECTMAX)? iters : 0, size1, coarseSolve(a1, b1, size1, iters));
+    TIMED(2, INTERPOLATE, 0, size2, interpolation(a1, a2, size2, size1));
 
-    jacobi(a2, b2, size2, 4);
-    interpolation(a2, a3, size3, size2);
+    TIMED(2, SMOOTH, 4, size2, jacobi(a2, b2, size2, 4, lmax2));
+    TIMED(3, INTERPOLATE, 0, size3, interpolation(a2, a3, size3, size2));
 
-    jacobi(a3, b3, size3, 4);
-    interpolation(a3, a4, size4, size3);
+    TIMED(3, SMOOTH, 4, size3, jacobi(a3, b3, size3, 4, lmax3));
+    TIMED(4, INTERPOLATE, 0, size4, interpolation(a3, a4, size4, size3));
 
-    jacobi(a4, b4, size4, 4);
+    TIMED(4, SMOOTH, 4, size4, jacobi(a4, b4, size4, 4, lmax4));
 
     /* V-Cycle complete, calculate the Max difference error in the finest grids */
-    maxDiff(a4, b4, size4);
+    TIMED(4, MAXDIFF, 0, size4, maxDiff(a4, b4, size4));
 
     /* Computational part of program over, take the end time*/
     end_time = omp_get_wtime();
 
 
+#ifdef PROFILE
+    profilePrint();
+#endif
     print(a4, size4);
     printf("%d %d %d\t", size1-2, iters, workers);
     printf("%g\t", end_time - start_time);
@@ -329,6 +602,7 @@ int main(int argc, char const *argv[])
     free(b2);
     free(b3);
     free(b4);
+    free(factor);
 
 
     return 0;
@@ -19,6 +19,12 @@
 #define MAXSIZE 1000
 #define MAXITERS 10000000
 
+/* largest coarsest grid, in interior points per side, that is solved directly. Measured with the profile
+build on one core, the direct solve takes as long as about 170 coarse jacobi sweeps at 24, 480 at 32,
+1500 at 64 and 6000 at 128 (0.36 s). Jacobi needs on the order of n^2 sweeps to converge, so the direct
+solve pays off up to about 32, above it it costs more than the coarse sweeps a V-Cycle usually gets */
+#define DIRECTMAX 32
+
 int iters;
 double start_time, end_time;
 FILE * output;
@@ -36,6 +42,79 @@ double read_timer() {
     gettimeofday( &end, NULL );
     return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
 }
+/* Instrumentation of the V-Cycle, compiled in with -DPROFILE. Every call in the V-Cycle is timed per level
+and phase, and the bytes moved and flops done are counted from a simple model of each kernel. The summary is
+written as csv to multigrid_seq_profile.csv. Without PROFILE the TIMED macro is just the call. */
+#define SMOOTH 0
+#define RESTRICT 1
+#define INTERPOLATE 2
+#define MAXDIFF 3
+#define PHASES 4
+#define LEVELS 4
+
+#ifdef PROFILE
+typedef struct{
+    int size, calls, sweeps;
+    double time, bytes, flops;
+} counter;
+
+counter counters[LEVELS][PHASES];
+const char* phaseNames[PHASES] = {"smooth", "restrict", "interpolate", "maxdiff"};
+
+/* Count one call of a phase on a level (1 is the coarsest), size is the grid size the kernel writes */
+void profileAdd(int level, int phase, int sweeps, int size, double time){
+    counter* c = &counters[level-1][phase];
+    double points = (double)(size - 2) * (size - 2);
+
+    /* bytes and flops per point: a jacobi half sweep streams one grid in and one out with 4 flops.
+    Restriction reads the 4 fine points under each coarse point, interpolation makes three passes over the
+    fine grid and maxDiff reads two grids. */
+    switch(phase){
+        case SMOOTH:
+            c->bytes += 2.0 * sweeps * points * 16;
+            c->flops += 2.0 * sweeps * points * 4;
+            break;
+        case RESTRICT:
+            c->bytes += points * 40;
+            c->flops += points * 6;
+            break;
+        case INTERPOLATE:
+            c->bytes += points * 26;
+            c->flops += points * 1.5;
+            break;
+        case MAXDIFF:
+            c->bytes += points * 16;
+            c->flops += points * 2;
+            break;
+    }
+    c->size = size;
+    c->calls++;
+    c->sweeps += sweeps;
+    c->time += time;
+}
+
+void profilePrint(){
+    int l, p;
+    FILE* csv = fopen("multigrid_seq_profile.csv", "w");
+
+    fprintf(csv, "level,size,phase,calls,sweeps,seconds,bytes,GB/s,GFLOP/s\n");
+    for(l = 0; l < LEVELS; l++){
+        for(p = 0; p < PHASES; p++){
+            counter* c = &counters[l][p];
+            if(c->calls == 0)
+                continue;
+            fprintf(csv, "%d,%d,%s,%d,%d,%g,%g,%g,%g\n", l+1, c->size, phaseNames[p], c->calls, c->sweeps, c->time,
+                c->bytes, (c->time > 0)? c->bytes / c->time * 1e-9 : 0.0, (c->time > 0)? c->flops / c->time * 1e-9 : 0.0);
+        }
+    }
+    fclose(csv);
+}
+
+#define TIMED(level, phase, sweeps, size, call) do{ double t0 = read_timer(); call; profileAdd(level, phase, sweeps, size, read_timer() - t0); }while(0)
+#else
+#define TIMED(level, phase, sweeps, size, call) call
+#endif
+
 /* Function for calculating the max difference between grids a & b with the size of size */
 double maxDiff(double** a, double** b, int size){
     int i, j;
@@ -83,6 +162,91 @@ void jacobi(double** a, double** b, int size, int iterations){
 }
 
 
+/* Coarsest grids with at most DIRECTMAX interior points per side are solved directly with a banded
+Cholesky factorization of the 5-point matrix A = 4I - neighbours. The factorization
+costs about n^4 flops and the two substitutions about 4 n^3. It is computed inside the
+timed solve, and the program solves only once. Larger coarse grids fall back to jacobi iterations. */
+double* factor = NULL;
+
+/* Banded Cholesky factorization A = L L^T on an n x n interior grid. Row k of L holds the n+1 entries
+from column k-n to k, entry (k, c) is stored at factor[k*(n+1) + c - k + n] */
+void factorize(int n){
+    int k, c, m, first;
+    int N = n*n, w = n + 1;
+    double sum;
+
+    free(factor);
+    factor = calloc((size_t)N*w, sizeof(double));
+    for(k = 0; k < N; k++){
+        first = (k > n)? k - n : 0;
+        for(c = first; c <= k; c++){
+            /* entry A[k][c] of the 5-point matrix, points are numbered row by row */
+            if(c == k)
+                sum = 4.0;
+            else if(c == k - n || (c == k - 1 && k % n != 0))
+                sum = -1.0;
+            else
+                sum = 0.0;
+            for(m = (c > n)? c - n : first; m < c; m++){
+                if(m >= first)
+                    sum -= factor[k*w + m - k + n] * factor[c*w + m - c + n];
+            }
+            if(c == k)
+                factor[k*w + n] = sqrt(sum);
+            else
+                factor[k*w + c - k + n] = sum / factor[c*w + n];
+        }
+    }
+}
+
+/* Solve the coarsest grid a, the boundary values of a make up the right hand side. b gets the same solution
+so the two grids agree as after converged jacobi iterations */
+void coarseSolve(double** a, double** b, int size, int iterations){
+    int i, j, k, m, first, last;
+    int n = size - 2, N = n*n, w = n + 1;
+    double sum, *x;
+
+    if(n > DIRECTMAX){
+        jacobi(a, b, size, iterations);
+        return;
+    }
+    factorize(n);
+
+    /* right hand side, the boundary neighbours of every interior point */
+    x = malloc(N*sizeof(double));
+    for(i = 1; i <= n; i++){
+        for(j = 1; j <= n; j++){
+            sum = 0.0;
+            if(i == 1) sum += a[0][j];
+            if(i == n) sum += a[n+1][j];
+            if(j == 1) sum += a[i][0];
+            if(j == n) sum += a[i][n+1];
+            x[(i-1)*n + j-1] = sum;
+        }
+    }
+    /* forward substitution L y = b, then back substitution L^T x = y */
+    for(k = 0; k < N; k++){
+        first = (k > n)? k - n : 0;
+        for(m = first; m < k; m++)
+            x[k] -= factor[k*w + m - k + n] * x[m];
+        x[k] /= factor[k*w + n];
+    }
+    for(k = N - 1; k >= 0; k--){
+        last = (k + n < N)? k + n : N - 1;
+        for(m = k + 1; m <= last; m++)
+            x[k] -= factor[m*w + k - m + n] * x[m];
+        x[k] /= factor[k*w + n];
+    }
+
+    for(i = 1; i <= n; i++){
+        for(j = 1; j <= n; j++){
+            a[i][j] = x[(i-1)*n + j-1];
+            b[i][j] = a[i][j];
+        }
+    }
+    free(x);
+}
+
 void print(double** a, int s){
     int i,j;
     output = fopen("multigrid_parallel_matrix.txt","w");
@@ -271,36 +435,39 @@ int main(int argc, char const *argv[])
 
     /* begin V-Cycle at the top level, restrict down to the coarsest level
     while doing 4 jacobi iterations on each level. */
-    jacobi(a4, b4, size4, 4);
-    restriction(a4, a3, size3);
+    TIMED(4, SMOOTH, 4, size4, jacobi(a4, b4, size4, 4));
+    TIMED(3, RESTRICT, 0, size3, restriction(a4, a3, size3));
 
-    jacobi(a3, b3, size3, 4);
-    restriction(a3, a2, size2);
+    TIMED(3, SMOOTH, 4, size3, jacobi(a3, b3, size3, 4));
+    TIMED(2, RESTRICT, 0, size2, restriction(a3, a2, size2));
 
-    jacobi(a2, b2, size2, 4);
-    restriction(a2, a1, size1);
+    TIMED(2, SMOOTH, 4, size2, jacobi(a2, b2, size2, 4));
+    TIMED(1, RESTRICT, 0, size1, restriction(a2, a1, size1));
 
-    /* Coarsest level reached. Perform iters number of jacobi iterations 
-    defined as input argument, and start interpolating back up to the finest grain level. 
+    /* Coarsest level reached. Solve it directly if it is small enough, otherwise perform iters number of jacobi
+    iterations defined as input argument, and start interpolating back up to the finest grain level. 
     One the way up, perform 4 jacobi iterations on each level. */
 
-    jacobi(a1, b1, size1, iters);
-    interpolation(a1, a2, size2, size1);
+    TIMED(1, SMOOTH, (size1 - 2 > DIRECTMAX)? iters : 0, size1, coarseSolve(a1, b1, size1, iters));
+    TIMED(2, INTERPOLATE, 0, size2, interpolation(a1, a2, size2, size1));
 
-    jacobi(a2, b2, size2, 4);
-    interpolation(a2, a3, size3, size2);
+    TIMED(2, SMOOTH, 4, size2, jacobi(a2, b2, size2, 4));
+    TIMED(3, INTERPOLATE, 0, size3, interpolation(a2, a3, size3, size2));
 
-    jacobi(a3, b3, size3, 4);
-    interpolation(a3, a4, size4, size3);
+    TIMED(3, SMOOTH, 4, size3, jacobi(a3, b3, size3, 4));
+    TIMED(4, INTERPOLATE, 0, size4, interpolation(a3, a4, size4, size3));
 
-    jacobi(a4, b4, size4, 4);
+    TIMED(4, SMOOTH, 4, size4, jacobi(a4, b4, size4, 4));
 
     /* V-Cycle complete, calculate the Max difference error in the finest grids */
-    maxDiff(a4, b4, size4);
+    TIMED(4, MAXDIFF, 0, size4, maxdiff = maxDiff(a4, b4, size4));
 
     /* Computational part of program over, take the end time*/
     end_time = read_timer();
     
+#ifdef PROFILE
+    profilePrint();
+#endif
     print(a4, size4);
     printf("%d %d\t", size1-2, iters);
     printf("%g\t", end_time - start_time);
@@ -314,6 +481,7 @@ int main(int argc, char const *argv[])
     free(b2);
     free(b3);
     free(b4);
+    free(factor);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,69 @@
+/* writes a matrix file for matrixSum and matrixSum-openmp
+
+   features: the file is a header of rows and columns as int64,
+             followed by rows*columns int32 values, row by row.
+             The values are the same hash of the seed and position
+             as in the matrix generated by matrixSum, so a square
+             file with the same seed gives the same result as the
+             generated matrix. The values are written one row at a
+             time, so the file can be larger than memory
+
+   usage under Linux:
+     gcc -O -o matrixGen matrixGen.c
+     ./matrixGen rows columns file [seed]
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+
+#define SEED 1  /* default seed, the same as in matrixSum */
+
+/* value at row i, column j of a cols columns wide matrix, the same as in matrixSum */
+int randomValue(unsigned long long seed, long long cols, long long i, long long j){
+  unsigned long long z = seed + (i*cols + j + 1)*0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+  z = z ^ (z >> 31);
+  return z % 99;
+}
+
+int main(int argc, char *argv[]) {
+  long long header[2];
+  long long i, j;
+  unsigned long long seed;
+  int *row;
+  FILE *out;
+
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s rows columns file [seed]\n", argv[0]);
+    return 1;
+  }
+  header[0] = atoll(argv[1]);
+  header[1] = atoll(argv[2]);
+  seed = (argc > 4)? strtoull(argv[4], NULL, 10) : SEED;
+  if (header[0] < 1 || header[1] < 1 || header[0] > 0x7fffffff || header[1] > 0x7fffffff) {
+    fprintf(stderr, "rows and columns must be between 1 and 2^31-1\n");
+    return 1;
+  }
+
+  out = fopen(argv[3], "wb");
+  row = malloc(header[1]*sizeof(int));
+  if (out == NULL || row == NULL) {
+    fprintf(stderr, "can't write %s\n", argv[3]);
+    return 1;
+  }
+
+  fwrite(header, sizeof(long long), 2, out);
+  for (i = 0; i < header[0]; i++) {
+    for (j = 0; j < header[1]; j++)
+      row[j] = randomValue(seed, header[1], i, j);
+    if (fwrite(row, sizeof(int), header[1], out) != header[1]) {
+      fprintf(stderr, "can't write %s\n", argv[3]);
+      return 1;
+    }
+  }
+
+  free(row);
+  fclose(out);
+  return 0;
+}
@@ -1,12 +1,31 @@
 /* matrix summation using pthreads
 
-   features: uses a barrier; the Worker[0] computes
-             the total sum from partial sums computed by Workers
-             and prints the total sum to the standard output
+   features: the Workers are a pool created once, the main thread
+             submits a job (fill or sum the matrix) and waits for
+             it with a barrier that spins before it sleeps, so the
+             matrix can be reduced reps times without creating
+             threads. Each Worker writes its sum, max and min to its
+             own cache line padded slot, the main thread combines
+             the slots in a tree reduction after the job is done,
+             so no locks are taken when the results are merged.
+             Rows are handed out chunk rows at a time, either from
+             one shared atomic counter (mode 0), or from a range
+             per worker where idle workers steal half of the rows
+             left in the range of another worker (mode 1).
+             The rows are reduced eight columns at a time with AVX2
+             when it is enabled, -DSCALAR builds the scalar loop.
+             Given a file written by matrixGen, the matrix is mapped
+             from it instead of generated, and rows the workers are
+             done with are dropped, so it can be larger than memory.
+             The generated matrix is filled in parallel, every value
+             is a hash of the seed and its position, so the matrix
+             only depends on the seed (-DSEED=n) and not on how many
+             workers there are, and every worker first touches the
+             strip of rows it starts with
 
    usage under Linux:
-     gcc matrixSum.c -lpthread
-     a.out size numWorkers
+     gcc -O -mavx2 matrixSum.c -lpthread
+     a.out size numWorkers chunk mode reps [file]
 
 */
 #ifndef _REENTRANT 
@@ -18,22 +37,71 @@
 #include <stdbool.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__AVX2__) && !defined(SCALAR)
+#include <immintrin.h>
+#endif
 #define MAXSIZE 10000  /* maximum matrix size */
-#define MAXWORKERS 10   /* maximum number of workers */
+#define MAXWORKERS 64   /* maximum number of workers */
+#define CACHELINE 64    /* bytes in a cache line */
+#define CHUNK 16        /* default number of rows per task */
+#ifndef SEED
+#define SEED 1          /* seed of the generated matrix */
+#endif
+#define SPINS 1000      /* times a barrier checks for the last worker before it sleeps */
+#define HEADER 16       /* bytes before the values in a matrix file, rows and columns as int64 */
+
+#define COUNTER 0       /* shared work counter */
+#define STEAL 1         /* per worker ranges with stealing */
+
+#define FILL 0          /* jobs of the pool: generate the matrix */
+#define SUM 1           /* reduce the matrix */
+#define QUIT 2          /* leave the pool */
+
+/* struct to hold max/min value with position in matrix */
+struct valuepos{
+  int x, y, value;
+};
+
+/* partial result of one worker, padded so no two workers write the same cache line */
+struct result{
+  long long total;
+  struct valuepos max, min;
+  char pad[CACHELINE - sizeof(long long) - 2*sizeof(struct valuepos)];
+};
+
+/* rows [next, end) left to a worker, packed in one word (next low, end high)
+   so the owner and thieves can update both with a single compare and swap */
+struct range{
+  unsigned long long bounds;
+  char pad[CACHELINE - sizeof(unsigned long long)];
+};
 
 pthread_mutex_t barrier;  /* mutex lock for the barrier */
-pthread_mutex_t max, min, sum;  /* mutex lock for the max, min, sum */
-pthread_mutex_t task;
 pthread_cond_t go;        /* condition variable for leaving */
 int numWorkers;           /* number of workers */ 
 int numArrived = 0;       /* number who have arrived */
+int numParties;           /* threads in the barrier, the workers and main */
+int sense = 0;            /* flipped by the last thread to arrive at the barrier */
+int job;                  /* the job of the pool */
 struct valuepos global_max, global_min; /* global max/min */
-int global_sum;
-int counter;
+long long global_sum;
+int counter;              /* next row to hand out in mode 0 */
+int chunk, mode;          /* rows per task, work distribution */
+int reps;                 /* times the matrix is reduced */
 
 double start_time, end_time; /* start and end times */
 int size, stripSize;  /* assume size is multiple of numWorkers */
-int sums[MAXWORKERS]; /* partial sums */
+int rows;             /* rows of the matrix, size is the number of columns */
+int *base;            /* first value of the matrix that is reduced */
+long stride;          /* values from the start of one row to the next */
+char *mapped;         /* the mapped matrix file, NULL if the matrix is generated */
+size_t mappedBytes;
+struct result results[MAXWORKERS] __attribute__((aligned(CACHELINE))); /* partial results */
+struct range ranges[MAXWORKERS] __attribute__((aligned(CACHELINE))); /* rows left per worker */
 int matrix[MAXSIZE][MAXSIZE]; /* matrix */
 
 //struct valuepos maximum[MAXWORKERS]; /* maximum value */
@@ -41,18 +109,57 @@ int matrix[MAXSIZE][MAXSIZE]; /* matrix */
 
 void *Worker(void *);
 
-/* a reusable counter barrier */
+/* a reusable sense reversing barrier. The last thread to arrive flips sense,
+   the others spin on it for a while, since the next job or the end of this one
+   is often close, and then sleep on the condition variable until it flips */
 void Barrier() {
-  pthread_mutex_lock(&barrier);
-  numArrived++;
-  if (numArrived == numWorkers) {
-    numArrived = 0;
+  int mySense = __atomic_load_n(&sense, __ATOMIC_ACQUIRE);
+  int spin;
+
+  if (__atomic_add_fetch(&numArrived, 1, __ATOMIC_ACQ_REL) == numParties) {
+    __atomic_store_n(&numArrived, 0, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&barrier);
+    __atomic_store_n(&sense, !mySense, __ATOMIC_RELEASE);
     pthread_cond_broadcast(&go);
-  } else
+    pthread_mutex_unlock(&barrier);
+    return;
+  }
+  for (spin = 0; spin < SPINS; spin++) {
+    if (__atomic_load_n(&sense, __ATOMIC_ACQUIRE) != mySense)
+      return;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+  pthread_mutex_lock(&barrier);
+  while (__atomic_load_n(&sense, __ATOMIC_ACQUIRE) == mySense)
     pthread_cond_wait(&go, &barrier);
   pthread_mutex_unlock(&barrier);
 }
 
+/* hand out the rows again, every worker starts with its own strip of rows in mode 1 */
+void resetTasks(){
+  int i;
+  counter = 0;
+  for (i = 0; i < numWorkers; i++) {
+    unsigned long long first = i*stripSize;
+    unsigned long long last = (i == numWorkers - 1) ? rows : first + stripSize;
+    ranges[i].bounds = first | (last << 32);
+  }
+}
+
+/* start a job on the pool, the barrier publishes job and the reset tasks to the workers */
+void poolSubmit(int newJob){
+  job = newJob;
+  resetTasks();
+  Barrier();
+}
+
+/* wait until every worker is done with the job */
+void poolWait(){
+  Barrier();
+}
+
 /* timer */
 double read_timer() {
     static bool initialized = false;
@@ -67,23 +174,94 @@ double read_timer() {
     return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
 }
 
-/* struct to hold max/min value with position in matrix */
-struct valuepos{
-  int x, y, value;
-};
+/* merge the partial results pairwise, in log2(numWorkers) rounds, into results[0] */
+void reduce(){
+  int i, stride;
+  for (stride = 1; stride < numWorkers; stride *= 2) {
+    for (i = 0; i + stride < numWorkers; i += 2*stride) {
+      results[i].total += results[i + stride].total;
+      if (results[i + stride].max.value > results[i].max.value)
+        results[i].max = results[i + stride].max;
+      if (results[i + stride].min.value < results[i].min.value)
+        results[i].min = results[i + stride].min;
+    }
+  }
+  global_sum = results[0].total;
+  global_max = results[0].max;
+  global_min = results[0].min;
+}
 
 void printSum(){
   end_time = read_timer();
 
-    printf("The total is %d\n", global_sum);
+    printf("The total is %lld\n", global_sum);
     printf("The maximum is %d located at [%d,%d]\n", global_max.value, global_max.y, global_max.x);
     printf("The minimum is %d located at [%d,%d]\n", global_min.value, global_min.y, global_min.x);
     printf("The execution time is %g sec\n", end_time - start_time);
+    if (reps > 1)
+      printf("The time per reduction is %g sec\n", (end_time - start_time) / reps);
+}
+
+/* value at row i, column j of a size columns wide matrix, the splitmix64 mixer
+   of the seed and the position, so any thread can draw any value in any order */
+int randomValue(unsigned long long seed, long long i, long long j){
+  unsigned long long z = seed + (i*size + j + 1)*0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+  z = z ^ (z >> 31);
+  return z % 99;
+}
+
+/* first value of row r */
+int *rowAt(int r){
+  return base + r*stride;
+}
+
+/* map a matrix file, a header of rows and columns as int64 followed by the int32 values row by row */
+void mapMatrix(const char *file){
+  long long header[2];
+  struct stat info;
+  int fd = open(file, O_RDONLY);
+
+  if (fd == -1 || read(fd, header, HEADER) != HEADER || fstat(fd, &info) == -1) {
+    fprintf(stderr, "can't read %s\n", file);
+    exit(1);
+  }
+  if (header[0] < 1 || header[1] < 1 || header[0] > 0x7fffffff || header[1] > 0x7fffffff
+      || info.st_size < HEADER || header[0] > (info.st_size - HEADER)/(long long)sizeof(int)/header[1]) {
+    fprintf(stderr, "%s is not a matrix file\n", file);
+    exit(1);
+  }
+  mappedBytes = info.st_size;
+  mapped = mmap(NULL, mappedBytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    fprintf(stderr, "can't map %s\n", file);
+    exit(1);
+  }
+  /* the workers read it front to back, so the kernel can read ahead and drop pages behind them */
+  madvise(mapped, mappedBytes, MADV_SEQUENTIAL);
+
+  rows = header[0];
+  size = header[1];
+  base = (int *)(mapped + HEADER);
+  stride = size;
+}
+
+/* tell the kernel the rows [first, end) of a mapped matrix won't be read again,
+   only pages completely inside the rows are dropped since a neighbour may still read the others */
+void releaseRows(int first, int end){
+  long page = sysconf(_SC_PAGESIZE);
+  unsigned long from = ((unsigned long)rowAt(first) + page - 1) & ~(page - 1);
+  unsigned long to = (unsigned long)rowAt(end) & ~(page - 1);
+
+  if (to > from)
+    madvise((void *)from, to - from, MADV_DONTNEED);
 }
 
 /* read command line, initialize, and create threads */
 int main(int argc, char *argv[]) {
-  int i, j;
+  int r;
   long l; /* use long in case of a 64-bit system */
   pthread_attr_t attr;
   pthread_t workerid[MAXWORKERS];
@@ -94,99 +272,266 @@ int main(int argc, char *argv[]) {
 
   /* initialize mutex and condition variable */
   pthread_mutex_init(&barrier, NULL);
-  pthread_mutex_init(&max, NULL);
-  pthread_mutex_init(&min, NULL);
-  pthread_mutex_init(&sum, NULL);
-  pthread_mutex_init(&task, NULL);
   pthread_cond_init(&go, NULL);
 
   /* read command line args if any */
   size = (argc > 1)? atoi(argv[1]) : MAXSIZE;
   numWorkers = (argc > 2)? atoi(argv[2]) : MAXWORKERS;
+  chunk = (argc > 3)? atoi(argv[3]) : CHUNK;
+  mode = (argc > 4)? atoi(argv[4]) : COUNTER;
+  reps = (argc > 5)? atoi(argv[5]) : 1;
   if (size > MAXSIZE) size = MAXSIZE;
   if (numWorkers > MAXWORKERS) numWorkers = MAXWORKERS;
-  stripSize = size/numWorkers;
+  if (chunk < 1) chunk = 1;
+  if (reps < 1) reps = 1;
+  numParties = numWorkers + 1;
+
+  /* the generated matrix, or the one in the file */
+  rows = size;
+  base = &matrix[0][0];
+  stride = MAXSIZE;
+  if (argc > 6)
+    mapMatrix(argv[6]);
+  stripSize = rows/numWorkers;
+
+  /* create the pool, the workers wait for the first job */
+  for (l = 0; l < numWorkers; l++)
+    pthread_create(&workerid[l], &attr, Worker, (void *) l);
 
-  /* initialize the matrix */
-  for (i = 0; i < size; i++) {
-	  for (j = 0; j < size; j++) {
-          matrix[i][j] = rand()%99;
-	  }
+  /* initialize the matrix, each worker fills the strip it starts with */
+  if (mapped == NULL) {
+    poolSubmit(FILL);
+    poolWait();
   }
   global_max.y = 0;
   global_max.x = 0;
-  global_max.value = matrix[0][0];
+  global_max.value = rowAt(0)[0];
 
   global_min.y = 0;
   global_min.x = 0;
-  global_min.value = matrix[0][0];
+  global_min.value = rowAt(0)[0];
 
   /* print the matrix */
-//#ifdef DEBUG
-  for (i = 0; i < size; i++) {
+#ifdef DEBUG
+  for (i = 0; i < rows; i++) {
 	  printf("[ ");
 	  for (j = 0; j < size; j++) {
-	    printf(" %d", matrix[i][j]);
+	    printf(" %d", rowAt(i)[j]);
 	  }
 	  printf(" ]\n");
   }
-//#endif
+#endif
 
-  /* do the parallel work: create the workers */
+  /* do the parallel work: reduce the matrix reps times on the pool */
   start_time = read_timer();
-  for (l = 0; l < numWorkers; l++)
-    pthread_create(&workerid[l], &attr, Worker, (void *) l);
-  
+  for (r = 0; r < reps; r++) {
+    poolSubmit(SUM);
+    poolWait();
+    reduce();
+  }
+  printSum();
+
   /* Make sure every thread is done */
+  poolSubmit(QUIT);
   for(l = 0; l < numWorkers; l++)
     pthread_join(workerid[l], NULL);
 
-  printSum();
+  if (mapped != NULL)
+    munmap(mapped, mappedBytes);
 
   pthread_exit(NULL);
 }
 
-void update_max(struct valuepos new){
-  pthread_mutex_lock(&max);
-  if(new.value > global_max.value)
-    global_max = new;
-  pthread_mutex_unlock(&max);
+/* add the values of one row to total and update max and min with their positions,
+   on ties the first position is kept, the same as the scalar loop. With AVX2 eight
+   columns are done at a time, every lane keeps its own max and min and the column
+   where it was found, and the lanes are resolved after the row */
+void reduceRow(int *row, int y, long long *total, struct valuepos *max, struct valuepos *min){
+  int i = 0;
+
+#if defined(__AVX2__) && !defined(SCALAR)
+  if (size >= 8) {
+    int k;
+    long long sums[8];
+    int maxs[8], mins[8], maxAt[8], minAt[8];
+    __m256i value, greater, less;
+    __m256i step = _mm256_set1_epi32(8);
+    __m256i column = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i vmax = _mm256_loadu_si256((__m256i *)row), vmin = vmax;
+    /* the sums are kept in 64 bit lanes, four per half of the eight columns */
+    __m256i sumLow = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(vmax));
+    __m256i sumHigh = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(vmax, 1));
+    __m256i imax = column, imin = column;
+
+    for (i = 8; i + 8 <= size; i += 8) {
+      column = _mm256_add_epi32(column, step);
+      value = _mm256_loadu_si256((__m256i *)(row + i));
+      sumLow = _mm256_add_epi64(sumLow, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(value)));
+      sumHigh = _mm256_add_epi64(sumHigh, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(value, 1)));
+      greater = _mm256_cmpgt_epi32(value, vmax);
+      less = _mm256_cmpgt_epi32(vmin, value);
+      vmax = _mm256_max_epi32(vmax, value);
+      vmin = _mm256_min_epi32(vmin, value);
+      imax = _mm256_blendv_epi8(imax, column, greater);
+      imin = _mm256_blendv_epi8(imin, column, less);
+    }
+    _mm256_storeu_si256((__m256i *)sums, sumLow);
+    _mm256_storeu_si256((__m256i *)(sums + 4), sumHigh);
+    _mm256_storeu_si256((__m256i *)maxs, vmax);
+    _mm256_storeu_si256((__m256i *)mins, vmin);
+    _mm256_storeu_si256((__m256i *)maxAt, imax);
+    _mm256_storeu_si256((__m256i *)minAt, imin);
+
+    /* the best lane is the one with the largest (smallest) value found at the lowest column */
+    for (k = 1; k < 8; k++) {
+      sums[0] += sums[k];
+      if (maxs[k] > maxs[0] || (maxs[k] == maxs[0] && maxAt[k] < maxAt[0])) {
+        maxs[0] = maxs[k];
+        maxAt[0] = maxAt[k];
+      }
+      if (mins[k] < mins[0] || (mins[k] == mins[0] && minAt[k] < minAt[0])) {
+        mins[0] = mins[k];
+        minAt[0] = minAt[k];
+      }
+    }
+    *total += sums[0];
+    if (maxs[0] > max->value) {
+      max->value = maxs[0];
+      max->y = y;
+      max->x = maxAt[0];
+    }
+    if (mins[0] < min->value) {
+      min->value = mins[0];
+      min->y = y;
+      min->x = minAt[0];
+    }
+  }
+#endif
+
+  /* the whole row without AVX2, otherwise the columns left after the last eight */
+  for (; i < size; i++) {
+    *total += row[i];
+    if (row[i] > max->value) {
+      max->value = row[i];
+      max->y = y;
+      max->x = i;
+    }
+    if (row[i] < min->value) {
+      min->value = row[i];
+      min->y = y;
+      min->x = i;
+    }
+  }
+}
+
+/* fill the rows of worker myid's strip of the generated matrix */
+void fillRows(long myid) {
+  int i, j, first, last;
+
+  first = myid*stripSize;
+  last = (myid == numWorkers - 1) ? size : first + stripSize;
+  for (i = first; i < last; i++)
+    for (j = 0; j < size; j++)
+      matrix[i][j] = randomValue(SEED, i, j);
 }
-void update_min(struct valuepos new){
-  pthread_mutex_lock(&min);
-  if(new.value < global_min.value)
-    global_min = new;
-  pthread_mutex_unlock(&min);
+
+/* take up to chunk rows from the front of a range, returns the first row or -1 if it is empty */
+int takeRange(struct range *r, int *end){
+  unsigned long long old, new;
+  int next, last;
+
+  old = __atomic_load_n(&r->bounds, __ATOMIC_ACQUIRE);
+  do {
+    next = (int)(old & 0xffffffff);
+    last = (int)(old >> 32);
+    if (next >= last)
+      return -1;
+    *end = (next + chunk < last) ? next + chunk : last;
+    new = (unsigned long long)*end | ((unsigned long long)last << 32);
+  } while (!__atomic_compare_exchange_n(&r->bounds, &old, new, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  return next;
 }
-void update_sum(int new){
-  pthread_mutex_lock(&sum);
-    global_sum += new;
-  pthread_mutex_unlock(&sum);
+
+/* move the back half of the first range with more than chunk rows left into my range,
+   returns false when no other worker has enough rows left to be worth stealing */
+bool steal(long myid){
+  unsigned long long old, new;
+  int k, next, last, middle;
+  long victim;
+
+  for (k = 1; k < numWorkers; k++) {
+    victim = (myid + k) % numWorkers;
+    old = __atomic_load_n(&ranges[victim].bounds, __ATOMIC_ACQUIRE);
+    do {
+      next = (int)(old & 0xffffffff);
+      last = (int)(old >> 32);
+      if (last - next <= chunk)
+        break;
+      middle = next + (last - next)/2;
+      new = (unsigned long long)next | ((unsigned long long)middle << 32);
+    } while (!__atomic_compare_exchange_n(&ranges[victim].bounds, &old, new, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    if (last - next > chunk) {
+      /* my range is empty, so no one else writes it */
+      __atomic_store_n(&ranges[myid].bounds, (unsigned long long)middle | ((unsigned long long)last << 32), __ATOMIC_RELEASE);
+      return true;
+    }
+  }
+  return false;
 }
 
-int getTask(){
-  if(counter < size){
-    //counter ++;
-    return counter++;
+/* get the next chunk of rows [first, end), returns the first row or -1 if all rows are taken */
+int getTask(long myid, int *end){
+  int first;
+
+  if (mode == COUNTER) {
+    first = __atomic_fetch_add(&counter, chunk, __ATOMIC_RELAXED);
+    if (first >= rows)
+      return -1;
+    *end = (first + chunk < rows) ? first + chunk : rows;
+    return first;
   }
 
-  return -1;
+  while ((first = takeRange(&ranges[myid], end)) == -1) {
+    if (!steal(myid))
+      return -1;
+  }
+  return first;
 }
 
-/* Each worker sums the values in one strip of the matrix.
-   After a barrier, worker(0) computes and prints the total */
+void sumRows(long);
+
+/* Each worker waits for a job, does its part of it and waits for the others,
+   until the job is to quit */
 void *Worker(void *arg) {
   long myid = (long) arg;
-  int total, i, j, first, last;
-  struct valuepos max, min;
 
 #ifdef DEBUG
   printf("worker %d (pthread id %d) has started\n", myid, pthread_self());
 #endif
 
+  while (true) {
+    Barrier();
+    if (job == QUIT)
+      break;
+    if (job == FILL)
+      fillRows(myid);
+    else
+      sumRows(myid);
+    Barrier();
+  }
+  return NULL;
+}
+
+/* sum the values in the chunks of rows worker myid gets from getTask
+   and leave its partial result in its slot for the main thread */
+void sumRows(long myid) {
+  int i, j, first, last;
+  long long total;
+  struct valuepos max, min;
+
   /* determine first and last rows of my strip */
   first = myid*stripSize;
-  last = (myid == numWorkers - 1) ? (size - 1) : (first + stripSize - 1);
+  last = (myid == numWorkers - 1) ? (rows - 1) : (first + stripSize - 1);
 
 
 
@@ -194,35 +539,23 @@ void *Worker(void *arg) {
   total = 0;
   max.y = 0;
   max.x = 0;
-  max.value = matrix[0][0];
+  max.value = rowAt(0)[0];
 
   min.y = 0;
   min.x = 0;
-  min.value = matrix[0][0];
+  min.value = rowAt(0)[0];
 
   while(true){
 
-    pthread_mutex_lock(&task);
-    int taskval = getTask();
-    pthread_mutex_unlock(&task);
+    int end;
+    int taskval = getTask(myid, &end);
     if(taskval == -1)
       break;
 
-    for(int i=0;i<size;i++){
-      total += matrix[taskval][i];
-
-      if(matrix[taskval][i] > max.value){
-        max.value = matrix[taskval][i];
-        max.y = taskval;
-        max.x = i;
-      }
-        
-      if(matrix[taskval][i] < min.value){
-        min.value = matrix[taskval][i];
-        min.y = taskval;
-        min.x = i;
-      } 
-    }
+    for(int r = taskval; r < end; r++)
+      reduceRow(rowAt(r), r, &total, &max, &min);
+    if(mapped != NULL)
+      releaseRows(taskval, end);
   }
 
   /* Used for 1st / 2nd
@@ -245,13 +578,10 @@ void *Worker(void *arg) {
   }
   */
 
-  /* part 2 and 3 */
-  if(max.value > global_max.value)
-    update_max(max);
-  if(min.value < global_min.value)
-    update_min(min);
-  
-  update_sum(total);
+  /* part 2 and 3, only this worker writes its slot, main reads it after the barrier in poolWait */
+  results[myid].total = total;
+  results[myid].max = max;
+  results[myid].min = min;
 
   /* Sum using barrier and arrays
   sums[myid] = total;
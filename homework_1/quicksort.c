@@ -1,28 +1,106 @@
+/* quick sort using pthreads
+
+   features: a fixed pool of numWorkers workers, each with its own
+             Chase-Lev deque of ranges left to sort. A worker
+             partitions its range, pushes the left half on the bottom
+             of its deque and goes on with the right half, until the
+             range is cutoff elements or less and is sorted
+             sequentially. Then it takes the next range from the bottom
+             of its own deque, and when that is empty it steals from the
+             top of the deque of a random other worker, so skewed
+             pivots don't leave workers idle. The sort is done when
+             every element is in place, which is counted down in
+             remaining. Before the pool starts, ranges of PARALLELMIN
+             elements or more in the top log2(numWorkers) levels are
+             partitioned by all threads: each partitions a block of
+             the range, then the large elements left of where the
+             split ends up are swapped in parallel with the small ones
+             right of it. The ranges below are dealt to the deques.
+             The pivot is the median of three, or the ninther for
+             larger ranges. Partitioning collects the offsets of the
+             elements to swap in blocks from both ends without
+             branches (BlockQuicksort), eight at a time with AVX2
+             unless compiled with -DSCALAR.
+             With mode 1 ranges are partitioned in three, smaller,
+             equal and larger than the pivot, as the Dutch national
+             flag, and with mode 2 around two pivots (Yaroslavskiy),
+             where a large middle part also has the keys equal to the
+             pivots moved to its ends. Either way keys equal to a
+             pivot are in place and left out of the recursion, which
+             pays off when there are few distinct keys
+
+   usage under Linux:
+     gcc -O -mavx2 quicksort.c -lpthread
+     a.out size numWorkers cutoff mode values
+   where mode is 0 two way, 1 three way or 2 dual pivot partitioning
+   and the keys are rand()%values
+
+*/
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <time.h>
 #include <sys/time.h>
+#include <string.h>
+#if defined(__AVX2__) && !defined(SCALAR)
+#include <immintrin.h>
+#endif
 
-#define MAXSIZE 10000  /* maximum matrix size */
-#define MAXTHREADS 10   /* maximum number of workers */
+#define MAXSIZE 100000000  /* maximum array size */
+#define MAXTHREADS 64   /* maximum number of workers */
+#define CUTOFF 10000    /* default size of the largest range sorted sequentially */
+#define DEQUESIZE 4096  /* ranges a deque holds, a power of two */
+#define CACHELINE 64
+#define EMPTY 0xffffffffffffffffULL  /* no range, from an empty deque or a lost steal */
+#define PARALLELMIN 1000000  /* smallest range that is partitioned in parallel */
+#define BLOCK 128       /* elements per block of the block partition, at most 248 */
+#define NINTHER 128     /* ranges this large take the ninther as pivot, smaller ones the median of three */
+#define VALUES 99       /* default number of distinct keys, rand()%VALUES */
 
+#define TWOWAY 0        /* partition modes */
+#define THREEWAY 1
+#define DUALPIVOT 2
 
-double start_time, end_time; /* start and end times */
-int array[MAXSIZE];
-int size, counter, threads;
 
-pthread_mutex_t count;
+double start_time, end_time; /* start and end times */
+int *array;
+int size, threads, cutoff;
+long remaining;         /* elements not yet in their sorted place */
+int parallelDepth;      /* ranges above this depth are partitioned in parallel */
+int mode;               /* how ranges are partitioned */
+int values;             /* the keys are 0 to values-1 */
+const char *modeNames[] = {"two way", "three way", "dual pivot"};
+int dealt;              /* ranges dealt to the deques before the pool starts */
 
-void *quicksort(void *);
-void* swap(int a,int b);
-int partition(int low, int high, int pivot);
+/* the parallel partition in progress, block b is blockFirst[b] to blockFirst[b+1]-1 */
+int blocks, value, misplaced, large, small;
+int blockFirst[MAXTHREADS+1], less[MAXTHREADS];
+int largeStart[MAXTHREADS], largeCount[MAXTHREADS], smallStart[MAXTHREADS], smallCount[MAXTHREADS];
 
+/* a Chase-Lev deque of ranges, each packed in one word (left low, right high).
+   The owner pushes and takes at bottom, thieves steal at top. top and bottom
+   are on their own cache lines since they are written by different threads */
 typedef struct{
-    int start;
-    int end;
-} info;
+    long top;
+    char pad1[CACHELINE - sizeof(long)];
+    long bottom;
+    char pad2[CACHELINE - sizeof(long)];
+    unsigned long long ranges[DEQUESIZE];
+} deque;
+
+deque deques[MAXTHREADS] __attribute__((aligned(CACHELINE)));
+
+void quicksort(int left, int right);
+void swap(int a,int b);
+int partition(int low, int high, int pivot);
+int choosePivot(int left, int right);
+int split(int left, int right, int *parts);
+#if defined(__AVX2__) && !defined(SCALAR)
+void initOffsets();
+#endif
+void splitTop(int left, int right, int depth);
 
 
 /* timer */
@@ -39,109 +117,538 @@ double read_timer() {
     return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
 }
 
+unsigned long long pack(int left, int right){
+    return (unsigned int)left | ((unsigned long long)(unsigned int)right << 32);
+}
+
+/* push a range on the bottom of my deque, returns false if it is full */
+bool push(deque *d, unsigned long long range){
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+
+    if(b - t >= DEQUESIZE)
+        return false;
+    __atomic_store_n(&d->ranges[b & (DEQUESIZE-1)], range, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* take the range at the bottom of my deque, racing thieves for the last one */
+unsigned long long take(deque *d){
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    long t;
+    unsigned long long range = EMPTY;
+
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if(t <= b){
+        range = __atomic_load_n(&d->ranges[b & (DEQUESIZE-1)], __ATOMIC_RELAXED);
+        if(t == b){
+            if(!__atomic_compare_exchange_n(&d->top, &t, t+1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                range = EMPTY;
+            __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELAXED);
+        }
+    }
+    else
+        __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELAXED);
+    return range;
+}
+
+/* steal the range at the top of another worker's deque */
+unsigned long long steal(deque *d){
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    long b;
+    unsigned long long range;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if(t >= b)
+        return EMPTY;
+    range = __atomic_load_n(&d->ranges[t & (DEQUESIZE-1)], __ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&d->top, &t, t+1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return EMPTY;
+    return range;
+}
+
+/* sort a range, splitting off all but the last part of large ranges for others to steal */
+void sortRange(long myid, int left, int right){
+    int parts[6], n, k, first, last, placed;
+
+    while(right - left + 1 > cutoff){
+        n = split(left, right, parts);
+        /* the elements that are not in a part are in place */
+        placed = right - left + 1;
+        for(k = 0; k < n; k++)
+            placed -= parts[2*k+1] - parts[2*k] + 1;
+        __atomic_sub_fetch(&remaining, placed, __ATOMIC_RELAXED);
+
+        for(k = 0; k < n-1; k++){
+            first = parts[2*k];
+            last = parts[2*k+1];
+            if(last - first + 1 > cutoff && push(&deques[myid], pack(first, last))){
+                /* pushed, someone will sort it */
+            }
+            else if(last >= first){
+                quicksort(first, last);
+                __atomic_sub_fetch(&remaining, last - first + 1, __ATOMIC_RELAXED);
+            }
+        }
+        left = parts[2*n-2];
+        right = parts[2*n-1];
+    }
+    if(right >= left){
+        quicksort(left, right);
+        __atomic_sub_fetch(&remaining, right - left + 1, __ATOMIC_RELAXED);
+    }
+}
+
+void *Worker(void *arg){
+    long myid = (long) arg;
+    unsigned int seed = myid + 1;
+    unsigned long long range;
+    int k, start;
+
+    while(__atomic_load_n(&remaining, __ATOMIC_RELAXED) > 0){
+        range = take(&deques[myid]);
+        /* try every other worker once, starting at a random one */
+        start = (threads > 1)? rand_r(&seed) % (threads - 1) : 0;
+        for(k = 0; range == EMPTY && k < threads - 1; k++)
+            range = steal(&deques[(myid + 1 + (start + k) % (threads - 1)) % threads]);
+        if(range == EMPTY){
+            sched_yield();
+            continue;
+        }
+        sortRange(myid, (int)(range & 0xffffffff), (int)(range >> 32));
+    }
+    return NULL;
+}
+
 int main(int argc, char *argv[]){
     pthread_attr_t attr;
-    info data;
+    pthread_t workerid[MAXTHREADS];
 
     int i;
     long l;
-    
+
     pthread_attr_init(&attr);
     pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
 
     size = (argc > 1)? atoi(argv[1]) : MAXSIZE;
     threads = (argc > 2)? atoi(argv[2]) : MAXTHREADS;
+    cutoff = (argc > 3)? atoi(argv[3]) : CUTOFF;
+    mode = (argc > 4)? atoi(argv[4]) : TWOWAY;
+    values = (argc > 5)? atoi(argv[5]) : VALUES;
     if (size > MAXSIZE) size = MAXSIZE;
     if (threads > MAXTHREADS) threads = MAXTHREADS;
+    if (threads < 1) threads = 1;
+    if (cutoff < 1) cutoff = 1;
+    if (mode < TWOWAY || mode > DUALPIVOT) mode = TWOWAY;
+    if (values < 1) values = 1;
+    for(parallelDepth = 0; (1 << parallelDepth) < threads; parallelDepth++);
+#if defined(__AVX2__) && !defined(SCALAR)
+    initOffsets();
+#endif
 
-    data.start = 0;
-    data.end = size-1;
+    array = malloc(size*sizeof(int));
     for(i=0;i<size;i++){
-        array[i] = rand()%99;
+        array[i] = rand()%values;
     }
 
     start_time = read_timer();
-    quicksort(&data);
+    /* partition the top levels in parallel, the ranges below them are the first ranges of the workers */
+    remaining = size;
+    splitTop(0, size-1, 0);
+    for(l = 1; l < threads; l++)
+        pthread_create(&workerid[l], &attr, Worker, (void *) l);
+    Worker((void *) 0);
+    for(l = 1; l < threads; l++)
+        pthread_join(workerid[l], NULL);
     end_time =read_timer();
 
-    printf("Sorting %d elements with %d threads took %gs\n",size, threads, end_time-start_time);
+    printf("Sorting %d elements of %d values with %d threads and %s partitioning took %gs\n",size, values, threads, modeNames[mode], end_time-start_time);
+    for(i = 1; i < size; i++){
+        if(array[i-1] > array[i]){
+            printf("The array is not sorted at %d\n", i);
+            break;
+        }
+    }
     if(size < 200){
         for (i = 0; i < size; i++) {
 	        printf(" %d", array[i]);
 	        printf(",");
-        }  
+        }
     }
+    free(array);
 
     pthread_exit(NULL);
 }
 
-void* quicksort(void *data){
-    info *info_in = (info*) data;
-    pthread_t new_thread;
-
-    int left = info_in->start;
-    int right = info_in->end;
-    int pivot = (left+right)/2;
+/* sequential quick sort of the elements left to right */
+void quicksort(int left, int right){
+    int parts[6], n, k;
 
     if(left < right){
-        pivot = partition(left,right,pivot);
-        
-        info info1;
-        info1.start = left;
-        info1.end = pivot-1;
-        
-        info info2;
-        info2.start = pivot+1;
-        info2.end = right;
-        
-        pthread_mutex_lock(&count);
-        if(counter < MAXTHREADS){
-            counter++;
-            pthread_mutex_unlock(&count);
-
-            pthread_create(&new_thread, NULL, quicksort, &info1);
-            quicksort(&info2);
-            pthread_join(new_thread,NULL);
-
-            pthread_mutex_lock(&count);
-            counter--;
-            pthread_mutex_unlock(&count);
-        }
-        else{
-            pthread_mutex_unlock(&count);
-            quicksort(&info1);
-            quicksort(&info2);
-        }
+        n = split(left, right, parts);
+        for(k = 0; k < n; k++)
+            quicksort(parts[2*k], parts[2*k+1]);
     }
-    
-
-
 }
-void* swap(int a,int b){
+void swap(int a,int b){
     int tmp = array[a];
     array[a] = array[b];
     array[b] = tmp;
 }
 
+#if defined(__AVX2__) && !defined(SCALAR)
+/* offsetTable[m] holds the positions of the set bits of the byte m, one per byte */
+unsigned long long offsetTable[256];
+
+void initOffsets(){
+    int m, bit, n;
+
+    for(m = 0; m < 256; m++){
+        offsetTable[m] = 0;
+        for(bit = 0, n = 0; bit < 8; bit++)
+            if(m & (1 << bit))
+                offsetTable[m] |= (unsigned long long)bit << (8*n++);
+    }
+}
+#endif
+
+/* the offsets in block of its BLOCK elements that are not smaller than value (large) or
+   not larger than it (!large), found without branches. Returns how many there are, offset
+   needs room for BLOCK+8. With AVX2 eight elements are compared at a time and their offsets
+   are looked up from the mask of the compare */
+int collect(const int *block, int value, bool large, unsigned char *offset){
+    int i, n = 0;
+#if defined(__AVX2__) && !defined(SCALAR)
+    __m256i v = _mm256_set1_epi32(value);
+    unsigned long long o;
+    int m;
+
+    for(i = 0; i < BLOCK; i += 8){
+        __m256i x = _mm256_loadu_si256((const __m256i *)(block + i));
+        /* the elements wanted are the ones the compare leaves clear */
+        __m256i outside = large? _mm256_cmpgt_epi32(v, x) : _mm256_cmpgt_epi32(x, v);
+        m = ~_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xff;
+        o = offsetTable[m] + i*0x0101010101010101ULL;
+        memcpy(offset + n, &o, 8);
+        n += __builtin_popcount(m);
+    }
+#else
+    for(i = 0; i < BLOCK; i++){
+        offset[n] = i;
+        n += large? !(block[i] < value) : !(value < block[i]);
+    }
+#endif
+    return n;
+}
+
+/* partition low to high around the element at pivot and return where it ends up.
+   Both sides stop on elements equal to the pivot, so equal elements are spread over both sides.
+   While there are two blocks left, the offsets of the elements to swap are collected in a
+   block from each end and swapped pairwise, as in BlockQuicksort, and a block is left when
+   all of its offsets are used. The elements left after that are scanned as usual */
 int partition(int low, int high, int pivot){
-    if(pivot != low)
-        swap(low,high);
-
-    pivot = low;
-    low++;
-    while(low <= high){
-        if(array[low] <= array[pivot])
-            low++;
-        else if(array[high]> array[pivot])
-            high--;
+    unsigned char offsetLeft[BLOCK+8], offsetRight[BLOCK+8];
+    int numLeft = 0, numRight = 0, startLeft = 0, startRight = 0;
+    int i = low + 1, j = high, k, n, value;
+
+    swap(low, pivot);
+    value = array[low];
+    /* the elements before i are not larger than value and the ones after j not smaller */
+    while(j - i + 1 >= 2*BLOCK){
+        if(numLeft == 0){
+            startLeft = 0;
+            numLeft = collect(array + i, value, true, offsetLeft);
+        }
+        if(numRight == 0){
+            startRight = 0;
+            numRight = collect(array + j - BLOCK + 1, value, false, offsetRight);
+        }
+        n = (numLeft < numRight)? numLeft : numRight;
+        for(k = 0; k < n; k++)
+            swap(i + offsetLeft[startLeft + k], j - BLOCK + 1 + offsetRight[startRight + k]);
+        numLeft -= n;
+        numRight -= n;
+        startLeft += n;
+        startRight += n;
+        if(numLeft == 0)
+            i += BLOCK;
+        if(numRight == 0)
+            j -= BLOCK;
+    }
+
+    i--;
+    j++;
+    while(true){
+        while(array[++i] < value)
+            if(i == high)
+                break;
+        while(value < array[--j])
+            if(j == low)
+                break;
+        if(i >= j)
+            break;
+        swap(i, j);
+    }
+    swap(low, j);
+
+    return j;
+}
+
+/* the index of the median of array[a], array[b] and array[c] */
+int median3(int a, int b, int c){
+    if(array[a] < array[b])
+        return (array[b] < array[c])? b : (array[a] < array[c])? c : a;
+    return (array[a] < array[c])? a : (array[b] < array[c])? c : b;
+}
+
+/* the median of three for small ranges and Tukey's ninther, the median of the medians of
+   three spread out triples, for large ones */
+int choosePivot(int left, int right){
+    int middle = left + (right - left)/2, step;
+
+    if(right - left + 1 < NINTHER)
+        return median3(left, middle, right);
+    step = (right - left)/8;
+    return median3(median3(left, left + step, left + 2*step),
+                   median3(middle - step, middle, middle + step),
+                   median3(right - 2*step, right - step, right));
+}
+
+/* partition left to right in three around the element at pivot, as the Dutch national flag:
+   the smaller elements end up before *lt, the equal ones from *lt to *gt and the larger after */
+void partition3(int left, int right, int pivot, int *lt, int *gt){
+    int i = left + 1, value;
+
+    swap(left, pivot);
+    value = array[left];
+    *lt = left;
+    *gt = right;
+    while(i <= *gt){
+        if(array[i] < value)
+            swap((*lt)++, i++);
+        else if(value < array[i])
+            swap(i, (*gt)--);
         else
-            swap(low,high);
+            i++;
     }
+}
 
-    if(high != pivot)
-        swap(pivot, high);
+/* partition left to right around two pivots taken at a third and two thirds of the range,
+   as Yaroslavskiy. The smaller pivot ends up at *lt and the larger at *gt, with the elements
+   smaller than the first before *lt, the ones larger than the second after *gt and the rest
+   between them */
+void dualPartition(int left, int right, int *lt, int *gt){
+    int k, low, high;
 
-    return high;
+    swap(left, left + (right - left)/3);
+    swap(right, right - (right - left)/3);
+    if(array[right] < array[left])
+        swap(left, right);
+    low = array[left];
+    high = array[right];
+
+    *lt = left + 1;
+    *gt = right - 1;
+    for(k = *lt; k <= *gt; k++){
+        if(array[k] < low)
+            swap(k, (*lt)++);
+        else if(high < array[k]){
+            while(high < array[*gt] && k < *gt)
+                (*gt)--;
+            swap(k, (*gt)--);
+            if(array[k] < low)
+                swap(k, (*lt)++);
+        }
+    }
+    (*lt)--;
+    (*gt)++;
+    swap(left, *lt);
+    swap(right, *gt);
 }
 
-   
\ No newline at end of file
+/* move the elements of *first to *last equal to low to the front and the ones equal to high
+   to the back, and narrow *first and *last to the elements between them */
+void gatherPivots(int *first, int *last, int low, int high){
+    int k;
+
+    for(k = *first; k <= *last; k++){
+        if(array[k] == low)
+            swap(k, (*first)++);
+        else if(array[k] == high){
+            while(array[*last] == high && k < *last)
+                (*last)--;
+            swap(k, (*last)--);
+            if(array[k] == low)
+                swap(k, (*first)++);
+        }
+    }
+}
+
+/* partition left to right of two elements or more as mode says and put the first and last
+   index of the parts that are left to sort in parts, returns how many parts there are.
+   A part of equal keys is in place and left out */
+int split(int left, int right, int *parts){
+    int pivot, lt, gt;
+
+    if(mode == THREEWAY){
+        partition3(left, right, choosePivot(left, right), &lt, &gt);
+        parts[0] = left;
+        parts[1] = lt - 1;
+        parts[2] = gt + 1;
+        parts[3] = right;
+        return 2;
+    }
+    if(mode == DUALPIVOT){
+        dualPartition(left, right, &lt, &gt);
+        parts[0] = left;
+        parts[1] = lt - 1;
+        if(array[lt] < array[gt]){
+            parts[2] = lt + 1;
+            parts[3] = gt - 1;
+            /* a large middle part has many keys equal to the pivots, they are in place too */
+            if(gt - lt > (right - left)/2)
+                gatherPivots(&parts[2], &parts[3], array[lt], array[gt]);
+            parts[4] = gt + 1;
+            parts[5] = right;
+            return 3;
+        }
+        parts[2] = gt + 1;
+        parts[3] = right;
+        return 2;
+    }
+    pivot = partition(left, right, choosePivot(left, right));
+    parts[0] = left;
+    parts[1] = pivot - 1;
+    parts[2] = pivot + 1;
+    parts[3] = right;
+    return 2;
+}
+
+/* move the elements of low to high smaller than value first without branches, returns how many there are */
+int partitionLess(int low, int high, int value){
+    int i = low, j, x;
+
+    /* every element is swapped to i, which only moves on past the small ones */
+    for(j = low; j <= high; j++){
+        x = array[j];
+        array[j] = array[i];
+        array[i] = x;
+        i += (x < value);
+    }
+    return i - low;
+}
+
+/* swap misplaced elements k0 to k1-1, the k:th large element left of the split with the
+   k:th small element right of it. The large (small) ones are in intervals, in order */
+void swapMisplaced(int k0, int k1, int *largeStart, int *largeCount, int large,
+                   int *smallStart, int *smallCount, int small){
+    int a = 0, b = 0, offA = k0, offB = k0, k;
+
+    for(k = k0; k < k1; k++){
+        while(a < large && offA >= largeCount[a])
+            offA -= largeCount[a++];
+        while(b < small && offB >= smallCount[b])
+            offB -= smallCount[b++];
+        swap(largeStart[a] + offA, smallStart[b] + offB);
+        offA++;
+        offB++;
+    }
+}
+
+/* collect the large elements left of split and the small ones right of it, from the
+   blocks partitioned by partitionLess. Returns how many elements are misplaced */
+int findMisplaced(int *blockFirst, int *less, int blocks, int split, int *largeStart, int *largeCount,
+                  int *large, int *smallStart, int *smallCount, int *small){
+    int b, first, last, misplaced = 0;
+
+    *large = *small = 0;
+    for(b = 0; b < blocks; b++){
+        /* block b is small elements, then large ones from blockFirst[b] + less[b] */
+        first = blockFirst[b] + less[b];
+        last = (blockFirst[b+1] < split)? blockFirst[b+1] : split;
+        if(last > first){
+            largeStart[*large] = first;
+            largeCount[(*large)++] = last - first;
+            misplaced += last - first;
+        }
+        first = (blockFirst[b] > split)? blockFirst[b] : split;
+        last = blockFirst[b] + less[b];
+        if(last > first){
+            smallStart[*small] = first;
+            smallCount[(*small)++] = last - first;
+        }
+    }
+    return misplaced;
+}
+
+void *PartitionBlock(void *arg){
+    long b = (long) arg;
+    less[b] = partitionLess(blockFirst[b], blockFirst[b+1]-1, value);
+    return NULL;
+}
+
+void *SwapBlock(void *arg){
+    long b = (long) arg;
+    swapMisplaced((long)b*misplaced/blocks, (long)(b+1)*misplaced/blocks,
+                  largeStart, largeCount, large, smallStart, smallCount, small);
+    return NULL;
+}
+
+/* run fn on every block, each in its own thread, block 0 in this one */
+void forBlocks(void *(*fn)(void *)){
+    pthread_t helper[MAXTHREADS];
+    long b;
+
+    for(b = 1; b < blocks; b++)
+        pthread_create(&helper[b], NULL, fn, (void *) b);
+    fn((void *) 0);
+    for(b = 1; b < blocks; b++)
+        pthread_join(helper[b], NULL);
+}
+
+/* partition low to high around the element at pivot like partition, with one thread per block.
+   The elements smaller than the pivot end up left of it and the others right of it */
+int parallelPartition(int low, int high, int pivot){
+    int b, split;
+
+    /* the pivot waits at high while the rest is partitioned */
+    swap(pivot, high);
+    value = array[high];
+    blocks = threads;
+    for(b = 0; b <= blocks; b++)
+        blockFirst[b] = low + (long)b*(high - low)/blocks;
+
+    forBlocks(PartitionBlock);
+
+    split = low;
+    for(b = 0; b < blocks; b++)
+        split += less[b];
+    misplaced = findMisplaced(blockFirst, less, blocks, split, largeStart, largeCount, &large,
+                              smallStart, smallCount, &small);
+
+    forBlocks(SwapBlock);
+
+    swap(split, high);
+    return split;
+}
+
+/* partition the top levels of the range in parallel and deal the ranges below them
+   to the deques of the workers, round robin */
+void splitTop(int left, int right, int depth){
+    int pivot;
+
+    if(right - left + 1 < PARALLELMIN || depth >= parallelDepth){
+        if(right >= left)
+            push(&deques[dealt++ % threads], pack(left, right));
+        return;
+    }
+    pivot = parallelPartition(left, right, choosePivot(left, right));
+    remaining--;
+    splitTop(left, pivot-1, depth+1);
+    splitTop(pivot+1, right, depth+1);
+}
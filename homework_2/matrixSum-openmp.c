@@ -1,21 +1,50 @@
 /* matrix summation using OpenMP
 
-   usage with gcc (version 4.2 or higher required):
-     gcc -O -fopenmp -o matrixSum-openmp matrixSum-openmp.c 
-     ./matrixSum-openmp size numWorkers
+   features: the rows are reduced eight columns at a time with AVX2
+             when it is enabled, -DSCALAR builds the scalar loop.
+             Given a file written by matrixGen (homework_1), the
+             matrix is mapped from it instead of generated, and rows
+             are dropped once reduced, so it can be larger than memory.
+             The generated matrix is filled in parallel with the same
+             static schedule as the reduction, every value is a hash
+             of the seed (-DSEED=n) and its position, so the matrix is
+             the same for any number of threads. The max and min with
+             their positions are combined with user defined reductions,
+             so no critical sections are needed, and the total is
+             summed in 64 bits
+
+   usage with gcc (version 4.9 or higher required):
+     gcc -O -mavx2 -fopenmp -o matrixSum-openmp matrixSum-openmp.c 
+     ./matrixSum-openmp size numWorkers [file]
 
 */
 
 #include <omp.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__AVX2__) && !defined(SCALAR)
+#include <immintrin.h>
+#endif
 #define MAXSIZE 10000  /* maximum matrix size */
 #define MAXWORKERS 10   /* maximum number of workers */
+#ifndef SEED
+#define SEED 1          /* seed of the generated matrix */
+#endif
+#define HEADER 16       /* bytes before the values in a matrix file, rows and columns as int64 */
 
 double start_time, end_time;
 int numWorkers;
 int size; 
 int matrix[MAXSIZE][MAXSIZE];
+int rows;             /* rows of the matrix, size is the number of columns */
+int *base;            /* first value of the matrix that is reduced */
+long stride;          /* values from the start of one row to the next */
+char *mapped;         /* the mapped matrix file, NULL if the matrix is generated */
+size_t mappedBytes;
 //void *Worker(void *);
 
 typedef struct{
@@ -23,9 +52,167 @@ typedef struct{
     int x, y;
 } info;
 
+/* the larger (smaller) of two values, on ties the first in row major order,
+   so the result doesn't depend on how the rows were split between threads */
+info maxOf(info a, info b){
+  if (b.value > a.value || (b.value == a.value && (b.y < a.y || (b.y == a.y && b.x < a.x))))
+    return b;
+  return a;
+}
+
+info minOf(info a, info b){
+  if (b.value < a.value || (b.value == a.value && (b.y < a.y || (b.y == a.y && b.x < a.x))))
+    return b;
+  return a;
+}
+
+/* every thread starts from the value before the loop, matrix[0][0] at [0,0] */
+#pragma omp declare reduction(maxloc : info : omp_out = maxOf(omp_out, omp_in)) initializer(omp_priv = omp_orig)
+#pragma omp declare reduction(minloc : info : omp_out = minOf(omp_out, omp_in)) initializer(omp_priv = omp_orig)
+
+/* value at row i, column j of a size columns wide matrix, the splitmix64 mixer
+   of the seed and the position, so any thread can draw any value in any order */
+int randomValue(unsigned long long seed, long long i, long long j){
+  unsigned long long z = seed + (i*size + j + 1)*0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+  z = z ^ (z >> 31);
+  return z % 99;
+}
+
+/* first value of row r */
+int *rowAt(int r){
+  return base + r*stride;
+}
+
+/* map a matrix file, a header of rows and columns as int64 followed by the int32 values row by row */
+void mapMatrix(const char *file){
+  long long header[2];
+  struct stat info;
+  int fd = open(file, O_RDONLY);
+
+  if (fd == -1 || read(fd, header, HEADER) != HEADER || fstat(fd, &info) == -1) {
+    fprintf(stderr, "can't read %s\n", file);
+    exit(1);
+  }
+  if (header[0] < 1 || header[1] < 1 || header[0] > 0x7fffffff || header[1] > 0x7fffffff
+      || info.st_size < HEADER || header[0] > (info.st_size - HEADER)/(long long)sizeof(int)/header[1]) {
+    fprintf(stderr, "%s is not a matrix file\n", file);
+    exit(1);
+  }
+  mappedBytes = info.st_size;
+  mapped = mmap(NULL, mappedBytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    fprintf(stderr, "can't map %s\n", file);
+    exit(1);
+  }
+  /* the threads read it front to back, so the kernel can read ahead and drop pages behind them */
+  madvise(mapped, mappedBytes, MADV_SEQUENTIAL);
+
+  rows = header[0];
+  size = header[1];
+  base = (int *)(mapped + HEADER);
+  stride = size;
+}
+
+/* tell the kernel row r of a mapped matrix won't be read again,
+   only pages completely inside the row are dropped since a neighbour may still read the others */
+void releaseRow(int r){
+  long page = sysconf(_SC_PAGESIZE);
+  unsigned long from = ((unsigned long)rowAt(r) + page - 1) & ~(page - 1);
+  unsigned long to = (unsigned long)rowAt(r + 1) & ~(page - 1);
+
+  if (to > from)
+    madvise((void *)from, to - from, MADV_DONTNEED);
+}
+
+/* add the values of one row to total and update max and min with their positions,
+   on ties the first position is kept, the same as the scalar loop. With AVX2 eight
+   columns are done at a time, every lane keeps its own max and min and the column
+   where it was found, and the lanes are resolved after the row */
+void reduceRow(int *row, int y, long long *total, info *max, info *min){
+  int i = 0;
+
+#if defined(__AVX2__) && !defined(SCALAR)
+  if (size >= 8) {
+    int k;
+    long long sums[8];
+    int maxs[8], mins[8], maxAt[8], minAt[8];
+    __m256i value, greater, less;
+    __m256i step = _mm256_set1_epi32(8);
+    __m256i column = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i vmax = _mm256_loadu_si256((__m256i *)row), vmin = vmax;
+    /* the sums are kept in 64 bit lanes, four per half of the eight columns */
+    __m256i sumLow = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(vmax));
+    __m256i sumHigh = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(vmax, 1));
+    __m256i imax = column, imin = column;
+
+    for (i = 8; i + 8 <= size; i += 8) {
+      column = _mm256_add_epi32(column, step);
+      value = _mm256_loadu_si256((__m256i *)(row + i));
+      sumLow = _mm256_add_epi64(sumLow, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(value)));
+      sumHigh = _mm256_add_epi64(sumHigh, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(value, 1)));
+      greater = _mm256_cmpgt_epi32(value, vmax);
+      less = _mm256_cmpgt_epi32(vmin, value);
+      vmax = _mm256_max_epi32(vmax, value);
+      vmin = _mm256_min_epi32(vmin, value);
+      imax = _mm256_blendv_epi8(imax, column, greater);
+      imin = _mm256_blendv_epi8(imin, column, less);
+    }
+    _mm256_storeu_si256((__m256i *)sums, sumLow);
+    _mm256_storeu_si256((__m256i *)(sums + 4), sumHigh);
+    _mm256_storeu_si256((__m256i *)maxs, vmax);
+    _mm256_storeu_si256((__m256i *)mins, vmin);
+    _mm256_storeu_si256((__m256i *)maxAt, imax);
+    _mm256_storeu_si256((__m256i *)minAt, imin);
+
+    /* the best lane is the one with the largest (smallest) value found at the lowest column */
+    for (k = 1; k < 8; k++) {
+      sums[0] += sums[k];
+      if (maxs[k] > maxs[0] || (maxs[k] == maxs[0] && maxAt[k] < maxAt[0])) {
+        maxs[0] = maxs[k];
+        maxAt[0] = maxAt[k];
+      }
+      if (mins[k] < mins[0] || (mins[k] == mins[0] && minAt[k] < minAt[0])) {
+        mins[0] = mins[k];
+        minAt[0] = minAt[k];
+      }
+    }
+    *total += sums[0];
+    if (maxs[0] > max->value) {
+      max->value = maxs[0];
+      max->y = y;
+      max->x = maxAt[0];
+    }
+    if (mins[0] < min->value) {
+      min->value = mins[0];
+      min->y = y;
+      min->x = minAt[0];
+    }
+  }
+#endif
+
+  /* the whole row without AVX2, otherwise the columns left after the last eight */
+  for (; i < size; i++) {
+    *total += row[i];
+    if (row[i] > max->value) {
+      max->value = row[i];
+      max->y = y;
+      max->x = i;
+    }
+    if (row[i] < min->value) {
+      min->value = row[i];
+      min->y = y;
+      min->x = i;
+    }
+  }
+}
+
 /* read command line, initialize, and create threads */
 int main(int argc, char *argv[]) {
-  int i, j, total=0;
+  int i, j;
+  long long total=0;
   info max, min;
 
   /* read command line args if any */
@@ -36,56 +223,49 @@ int main(int argc, char *argv[]) {
 
   omp_set_num_threads(numWorkers);
 
-  /* initialize the matrix */
-  for (i = 0; i < size; i++) {
-      //printf("[ ");
-	  for (j = 0; j < size; j++) {
-      matrix[i][j] = rand()%99;
-      	  //printf(" %d", matrix[i][j]);
-	  }
-	  	  //printf(" ]\n");
+  /* the generated matrix, or the one in the file */
+  rows = size;
+  base = &matrix[0][0];
+  stride = MAXSIZE;
+  if (argc > 3)
+    mapMatrix(argv[3]);
+
+  /* initialize the matrix, rows are first touched by the thread that reduces them */
+  if (mapped == NULL) {
+#pragma omp parallel for private(j)
+    for (i = 0; i < size; i++) {
+        //printf("[ ");
+	    for (j = 0; j < size; j++) {
+        matrix[i][j] = randomValue(SEED, i, j);
+        	  //printf(" %d", matrix[i][j]);
+	    }
+	    	  //printf(" ]\n");
+    }
   }
 
-  max.value = matrix[0][0];
+  max.value = rowAt(0)[0];
   max.x = 0;
   max.y = 0;
-  min.value = matrix[0][0];
+  min.value = rowAt(0)[0];
   min.x = 0;
   min.y = 0;
   start_time = omp_get_wtime();
-#pragma omp parallel for reduction (+:total) private(j)
-  for (i = 0; i < size; i++)
-    for (j = 0; j < size; j++){
-      total += matrix[i][j];
-
-      if(max.value < matrix[i][j]){
-        
-        #pragma omp critical
-        if(max.value < matrix[i][j]){
-          max.value = matrix[i][j];
-          max.y = i;
-          max.x = j;
-        }
-      }
-      
-      if(min.value > matrix[i][j]){
-        
-        #pragma omp critical
-        if(min.value > matrix[i][j]){
-          min.value = matrix[i][j];
-          min.y = i;
-          min.x = j;
-        }
-      }
-        
-    }
+#pragma omp parallel for reduction (+:total) reduction (maxloc:max) reduction (minloc:min)
+  for (i = 0; i < rows; i++){
+    reduceRow(rowAt(i), i, &total, &max, &min);
+    if (mapped != NULL)
+      releaseRow(i);
+  }
 // implicit barrier
 
   end_time = omp_get_wtime();
 
-  printf("the total is %d\n", total);
+  printf("the total is %lld\n", total);
   printf("The maximum is %d located at [%d,%d]\n", max.value, max.y, max.x);
   printf("The minimum is %d located at [%d,%d]\n", min.value, min.y, min.x);
   printf("it took %g seconds\n", end_time-start_time);
+
+  if (mapped != NULL)
+    munmap(mapped, mappedBytes);
 }
 
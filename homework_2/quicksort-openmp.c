@@ -1,127 +1,808 @@
 /* quick sort using OpenMP
 
+   features: the two halves after a partition are sorted in parallel,
+             one of them in a new task, as long as the range is larger
+             than cutoff elements and the recursion is less than
+             MAXDEPTH levels deep, below that it is sorted in the task
+             it is in. Ranges of INSERTION elements or less are sorted
+             with insertion sort. A task waits for the task it created,
+             so a call returns when its range is sorted. Partitioning
+             stops on keys equal to the pivot, so the many duplicates
+             of rand()%99 split evenly. Ranges of PARALLELMIN elements
+             or more in the top log2(numWorkers) levels are partitioned
+             by all threads: each partitions a block of the range, then
+             the large elements left of where the split ends up are
+             swapped in parallel with the small ones right of it.
+             The pivot is the median of three, or the ninther for
+             larger ranges. Partitioning collects the offsets of the
+             elements to swap in blocks from both ends without
+             branches (BlockQuicksort), eight at a time with AVX2
+             unless compiled with -DSCALAR.
+             With mode 1 ranges are partitioned in three, smaller,
+             equal and larger than the pivot, as the Dutch national
+             flag, and with mode 2 around two pivots (Yaroslavskiy),
+             where a large middle part also has the keys equal to the
+             pivots moved to its ends. Either way keys equal to a
+             pivot are in place and left out of the recursion, which
+             pays off when there are few distinct keys.
+             There are two more engines. Sample sort picks splitters
+             from an oversampled, sorted sample, every thread finds
+             the bucket of each element of its block, the counts are
+             prefix summed and the elements scattered to a second
+             array, where the buckets are sorted in parallel. Merge
+             sort sorts the halves in tasks down to cutoff elements
+             and merges them, splitting large merges into tasks
+             around the middle of the longer run. Radix sort sorts the
+             keys minus the smallest one a byte at a time, only as
+             many bytes as the range of the keys needs: every thread
+             counts the digits of its block, the counts are prefix
+             summed and every thread scatters its block through a
+             buffer of a cache line per digit, so whole lines are
+             written. Keys in a range of at most COUNTINGMAX values,
+             such as rand()%99, are counting sorted instead: the keys
+             are counted and written back in order. There is no
+             automatic choice of engine until
+             make benchmark-quicksort-engines has measured where the
+             engines cross over on more than one core
+
    usage with gcc (version 4.2 or higher required):
-     gcc -O -fopenmp -o quicksort-openmp quicksort-openmp.c 
-     ./quicksort-openmp size numWorkers
+     gcc -O -fopenmp -mavx2 -o quicksort-openmp quicksort-openmp.c 
+     ./quicksort-openmp size numWorkers cutoff engine mode values
+   where engine is 0 quicksort, 1 sample sort, 2 merge sort or 3 radix sort,
+   mode is 0 two way, 1 three way or 2 dual pivot partitioning and the keys are rand()%values
 
 */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <omp.h>
+#include <string.h>
+#if defined(__AVX2__) && !defined(SCALAR)
+#include <immintrin.h>
+#endif
 
-#define MAXSIZE 100000  /* maximum matrix size */
+#define MAXSIZE 100000000  /* maximum array size */
 #define MAXTHREADS 10   /* maximum number of workers */
+#define CUTOFF 10000    /* default size of the smallest range sorted in a new task */
+#define MAXDEPTH 24     /* no new tasks below this depth */
+#define INSERTION 32    /* ranges this small are sorted with insertion sort */
+#define PARALLELMIN 1000000  /* smallest range that is partitioned in parallel */
+#define BLOCK 128       /* elements per block of the block partition, at most 248 */
+#define NINTHER 128     /* ranges this large take the ninther as pivot, smaller ones the median of three */
+#define VALUES 99       /* default number of distinct keys, rand()%VALUES */
+
+#define TWOWAY 0        /* partition modes */
+#define THREEWAY 1
+#define DUALPIVOT 2
+#define MAXBLOCKS 64    /* most blocks of a parallel partition */
+#define OVERSAMPLE 32   /* samples per bucket of sample sort */
+#define BUCKETS 4       /* buckets per thread of sample sort */
+#define MAXBUCKETS 256  /* most buckets, so the bucket of an element fits in a byte */
+#define MERGECUTOFF 100000  /* smallest merge that is split in tasks */
+#define RADIXBITS 8     /* bits per digit of radix sort */
+#define RADIX (1 << RADIXBITS)
+#define LINE 16         /* keys in a cache line, the size of the write combining buffers */
+#define COUNTINGMAX 65536  /* key ranges this small are counting sorted */
+
+#define QUICKSORT 0
+#define SAMPLESORT 1
+#define MERGESORT 2
+#define RADIXSORT 3
 
 
 double start_time, end_time; /* start and end times */
-int array[MAXSIZE];
-int size, counter, threads;
+int *array;
+int size, counter, threads, cutoff;
+int parallelDepth;      /* ranges above this depth are partitioned in parallel */
+int mode;               /* how ranges are partitioned */
+int values;             /* the keys are 0 to values-1 */
+const char *modeNames[] = {"two way", "three way", "dual pivot"};
+int engine;
+const char *engineNames[] = {"quicksort", "sample sort", "merge sort", "radix sort"};
 
-void *quicksort(void *);
-void* swap(int a,int b);
+void quicksort(int left, int right, int depth);
+void swap(int a,int b);
 int partition(int low, int high, int pivot);
-
-typedef struct{
-    int start;
-    int end;
-} info;
+int choosePivot(int left, int right);
+int split(int left, int right, int *parts);
+#if defined(__AVX2__) && !defined(SCALAR)
+void initOffsets();
+#endif
+int parallelPartition(int low, int high, int pivot);
+void samplesort();
+void radixsort();
+void mergesort(int *tmp, int left, int right, int depth);
 
 int main(int argc, char *argv[]){
-    info data;
-
     int i;
-    long l;
 
     size = (argc > 1)? atoi(argv[1]) : MAXSIZE;
     threads = (argc > 2)? atoi(argv[2]) : MAXTHREADS;
+    cutoff = (argc > 3)? atoi(argv[3]) : CUTOFF;
+    engine = (argc > 4)? atoi(argv[4]) : QUICKSORT;
+    mode = (argc > 5)? atoi(argv[5]) : TWOWAY;
+    values = (argc > 6)? atoi(argv[6]) : VALUES;
     if (size > MAXSIZE) size = MAXSIZE;
     if (threads > MAXTHREADS) threads = MAXTHREADS;
+    if (threads < 1) threads = 1;
+    if (cutoff < INSERTION) cutoff = INSERTION;
+    if (engine < QUICKSORT || engine > RADIXSORT) engine = QUICKSORT;
+    if (mode < TWOWAY || mode > DUALPIVOT) mode = TWOWAY;
+    if (values < 1) values = 1;
     
     omp_set_num_threads(threads);
+#if defined(__AVX2__) && !defined(SCALAR)
+    initOffsets();
+#endif
+    for(parallelDepth = 0; (1 << parallelDepth) < threads; parallelDepth++);
 
-    data.start = 0;
-    data.end = size-1;
+    array = malloc(size*sizeof(int));
     for(i=0;i<size;i++){
-        array[i] = rand()%99;
+        array[i] = rand()%values;
     }
 
     start_time = omp_get_wtime();
-    #pragma omp parallel
-    {
-    #pragma omp single
-    quicksort(&data);
+    if(engine == SAMPLESORT)
+        samplesort();
+    else if(engine == RADIXSORT)
+        radixsort();
+    else if(engine == MERGESORT){
+        int *tmp = malloc(size*sizeof(int));
+        #pragma omp parallel
+        {
+        #pragma omp single
+        mergesort(tmp, 0, size-1, 0);
+        }
+        free(tmp);
+    }
+    else{
+        #pragma omp parallel
+        {
+        #pragma omp single
+        quicksort(0, size-1, 0);
+        }
     }
     
 
 
     end_time = omp_get_wtime();
 
-    printf("Sorting %d elements with %d threads took %gs\n",size, threads, end_time-start_time);
+    printf("Sorting %d elements of %d values with %d threads using %s, %s partitioning took %gs\n",size, values, threads, engineNames[engine], modeNames[mode], end_time-start_time);
+    for(i = 1; i < size; i++){
+        if(array[i-1] > array[i]){
+            printf("The array is not sorted at %d\n", i);
+            break;
+        }
+    }
     if(size < 200){
         for (i = 0; i < size; i++) {
 	        printf(" %d", array[i]);
 	        printf(",");
         }  
     }
+    free(array);
 }
 
-void* quicksort(void *data){
-    info *info_in = (info*) data;
+/* sort the elements left to right with insertion sort */
+void insertionSort(int left, int right){
+    int i, j, value;
+    for(i = left+1; i <= right; i++){
+        value = array[i];
+        for(j = i; j > left && array[j-1] > value; j--)
+            array[j] = array[j-1];
+        array[j] = value;
+    }
+}
 
-    int left = info_in->start;
-    int right = info_in->end;
-    int pivot = (left+right)/2;
+void quicksort(int left, int right, int depth){
+    int parts[6], n, k, pivot;
 
-    if(left < right){
-        pivot = partition(left,right,pivot);
-        
-        info info1;
-        info1.start = left;
-        info1.end = pivot-1;
-        
-        info info2;
-        info2.start = pivot+1;
-        info2.end = right;
-        
-        //#pragma omp parallel sections
-        {
-            #pragma omp task
-            quicksort(&info1);
+    if(right - left + 1 <= INSERTION){
+        insertionSort(left, right);
+        return;
+    }
 
+    if(right - left + 1 >= PARALLELMIN && depth < parallelDepth){
+        pivot = parallelPartition(left, right, choosePivot(left, right));
+        parts[0] = left;
+        parts[1] = pivot - 1;
+        parts[2] = pivot + 1;
+        parts[3] = right;
+        n = 2;
+    }
+    else
+        n = split(left, right, parts);
+
+    /* only ranges worth the overhead of a task are split, the last part is sorted by this task */
+    if(right - left + 1 > cutoff && depth < MAXDEPTH){
+        for(k = 0; k < n-1; k++){
             #pragma omp task
-            quicksort(&info2);
+            quicksort(parts[2*k], parts[2*k+1], depth+1);
         }
+        quicksort(parts[2*n-2], parts[2*n-1], depth+1);
+        #pragma omp taskwait
+    }
+    else{
+        for(k = 0; k < n; k++)
+            quicksort(parts[2*k], parts[2*k+1], depth+1);
     }
-    
-
-
 }
-void* swap(int a,int b){
+void swap(int a,int b){
     int tmp = array[a];
     array[a] = array[b];
     array[b] = tmp;
 }
 
+#if defined(__AVX2__) && !defined(SCALAR)
+/* offsetTable[m] holds the positions of the set bits of the byte m, one per byte */
+unsigned long long offsetTable[256];
+
+void initOffsets(){
+    int m, bit, n;
+
+    for(m = 0; m < 256; m++){
+        offsetTable[m] = 0;
+        for(bit = 0, n = 0; bit < 8; bit++)
+            if(m & (1 << bit))
+                offsetTable[m] |= (unsigned long long)bit << (8*n++);
+    }
+}
+#endif
+
+/* the offsets in block of its BLOCK elements that are not smaller than value (large) or
+   not larger than it (!large), found without branches. Returns how many there are, offset
+   needs room for BLOCK+8. With AVX2 eight elements are compared at a time and their offsets
+   are looked up from the mask of the compare */
+int collect(const int *block, int value, bool large, unsigned char *offset){
+    int i, n = 0;
+#if defined(__AVX2__) && !defined(SCALAR)
+    __m256i v = _mm256_set1_epi32(value);
+    unsigned long long o;
+    int m;
+
+    for(i = 0; i < BLOCK; i += 8){
+        __m256i x = _mm256_loadu_si256((const __m256i *)(block + i));
+        /* the elements wanted are the ones the compare leaves clear */
+        __m256i outside = large? _mm256_cmpgt_epi32(v, x) : _mm256_cmpgt_epi32(x, v);
+        m = ~_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xff;
+        o = offsetTable[m] + i*0x0101010101010101ULL;
+        memcpy(offset + n, &o, 8);
+        n += __builtin_popcount(m);
+    }
+#else
+    for(i = 0; i < BLOCK; i++){
+        offset[n] = i;
+        n += large? !(block[i] < value) : !(value < block[i]);
+    }
+#endif
+    return n;
+}
+
+/* partition low to high around the element at pivot and return where it ends up.
+   Both sides stop on elements equal to the pivot, so equal elements are spread over both sides.
+   While there are two blocks left, the offsets of the elements to swap are collected in a
+   block from each end and swapped pairwise, as in BlockQuicksort, and a block is left when
+   all of its offsets are used. The elements left after that are scanned as usual */
 int partition(int low, int high, int pivot){
-    if(pivot != low)
-        swap(low,high);
-
-    pivot = low;
-    low++;
-    while(low <= high){
-        if(array[low] <= array[pivot])
-            low++;
-        else if(array[high]> array[pivot])
-            high--;
+    unsigned char offsetLeft[BLOCK+8], offsetRight[BLOCK+8];
+    int numLeft = 0, numRight = 0, startLeft = 0, startRight = 0;
+    int i = low + 1, j = high, k, n, value;
+
+    swap(low, pivot);
+    value = array[low];
+    /* the elements before i are not larger than value and the ones after j not smaller */
+    while(j - i + 1 >= 2*BLOCK){
+        if(numLeft == 0){
+            startLeft = 0;
+            numLeft = collect(array + i, value, true, offsetLeft);
+        }
+        if(numRight == 0){
+            startRight = 0;
+            numRight = collect(array + j - BLOCK + 1, value, false, offsetRight);
+        }
+        n = (numLeft < numRight)? numLeft : numRight;
+        for(k = 0; k < n; k++)
+            swap(i + offsetLeft[startLeft + k], j - BLOCK + 1 + offsetRight[startRight + k]);
+        numLeft -= n;
+        numRight -= n;
+        startLeft += n;
+        startRight += n;
+        if(numLeft == 0)
+            i += BLOCK;
+        if(numRight == 0)
+            j -= BLOCK;
+    }
+
+    i--;
+    j++;
+    while(true){
+        while(array[++i] < value)
+            if(i == high)
+                break;
+        while(value < array[--j])
+            if(j == low)
+                break;
+        if(i >= j)
+            break;
+        swap(i, j);
+    }
+    swap(low, j);
+
+    return j;
+}
+
+/* the index of the median of array[a], array[b] and array[c] */
+int median3(int a, int b, int c){
+    if(array[a] < array[b])
+        return (array[b] < array[c])? b : (array[a] < array[c])? c : a;
+    return (array[a] < array[c])? a : (array[b] < array[c])? c : b;
+}
+
+/* the median of three for small ranges and Tukey's ninther, the median of the medians of
+   three spread out triples, for large ones */
+int choosePivot(int left, int right){
+    int middle = left + (right - left)/2, step;
+
+    if(right - left + 1 < NINTHER)
+        return median3(left, middle, right);
+    step = (right - left)/8;
+    return median3(median3(left, left + step, left + 2*step),
+                   median3(middle - step, middle, middle + step),
+                   median3(right - 2*step, right - step, right));
+}
+
+/* partition left to right in three around the element at pivot, as the Dutch national flag:
+   the smaller elements end up before *lt, the equal ones from *lt to *gt and the larger after */
+void partition3(int left, int right, int pivot, int *lt, int *gt){
+    int i = left + 1, value;
+
+    swap(left, pivot);
+    value = array[left];
+    *lt = left;
+    *gt = right;
+    while(i <= *gt){
+        if(array[i] < value)
+            swap((*lt)++, i++);
+        else if(value < array[i])
+            swap(i, (*gt)--);
+        else
+            i++;
+    }
+}
+
+/* partition left to right around two pivots taken at a third and two thirds of the range,
+   as Yaroslavskiy. The smaller pivot ends up at *lt and the larger at *gt, with the elements
+   smaller than the first before *lt, the ones larger than the second after *gt and the rest
+   between them */
+void dualPartition(int left, int right, int *lt, int *gt){
+    int k, low, high;
+
+    swap(left, left + (right - left)/3);
+    swap(right, right - (right - left)/3);
+    if(array[right] < array[left])
+        swap(left, right);
+    low = array[left];
+    high = array[right];
+
+    *lt = left + 1;
+    *gt = right - 1;
+    for(k = *lt; k <= *gt; k++){
+        if(array[k] < low)
+            swap(k, (*lt)++);
+        else if(high < array[k]){
+            while(high < array[*gt] && k < *gt)
+                (*gt)--;
+            swap(k, (*gt)--);
+            if(array[k] < low)
+                swap(k, (*lt)++);
+        }
+    }
+    (*lt)--;
+    (*gt)++;
+    swap(left, *lt);
+    swap(right, *gt);
+}
+
+/* move the elements of *first to *last equal to low to the front and the ones equal to high
+   to the back, and narrow *first and *last to the elements between them */
+void gatherPivots(int *first, int *last, int low, int high){
+    int k;
+
+    for(k = *first; k <= *last; k++){
+        if(array[k] == low)
+            swap(k, (*first)++);
+        else if(array[k] == high){
+            while(array[*last] == high && k < *last)
+                (*last)--;
+            swap(k, (*last)--);
+            if(array[k] == low)
+                swap(k, (*first)++);
+        }
+    }
+}
+
+/* partition left to right of two elements or more as mode says and put the first and last
+   index of the parts that are left to sort in parts, returns how many parts there are.
+   A part of equal keys is in place and left out */
+int split(int left, int right, int *parts){
+    int pivot, lt, gt;
+
+    if(mode == THREEWAY){
+        partition3(left, right, choosePivot(left, right), &lt, &gt);
+        parts[0] = left;
+        parts[1] = lt - 1;
+        parts[2] = gt + 1;
+        parts[3] = right;
+        return 2;
+    }
+    if(mode == DUALPIVOT){
+        dualPartition(left, right, &lt, &gt);
+        parts[0] = left;
+        parts[1] = lt - 1;
+        if(array[lt] < array[gt]){
+            parts[2] = lt + 1;
+            parts[3] = gt - 1;
+            /* a large middle part has many keys equal to the pivots, they are in place too */
+            if(gt - lt > (right - left)/2)
+                gatherPivots(&parts[2], &parts[3], array[lt], array[gt]);
+            parts[4] = gt + 1;
+            parts[5] = right;
+            return 3;
+        }
+        parts[2] = gt + 1;
+        parts[3] = right;
+        return 2;
+    }
+    pivot = partition(left, right, choosePivot(left, right));
+    parts[0] = left;
+    parts[1] = pivot - 1;
+    parts[2] = pivot + 1;
+    parts[3] = right;
+    return 2;
+}
+
+   
+
+/* move the elements of low to high smaller than value first without branches, returns how many there are */
+int partitionLess(int low, int high, int value){
+    int i = low, j, x;
+
+    /* every element is swapped to i, which only moves on past the small ones */
+    for(j = low; j <= high; j++){
+        x = array[j];
+        array[j] = array[i];
+        array[i] = x;
+        i += (x < value);
+    }
+    return i - low;
+}
+
+/* swap misplaced elements k0 to k1-1, the k:th large element left of the split with the
+   k:th small element right of it. The large (small) ones are in intervals, in order */
+void swapMisplaced(int k0, int k1, int *largeStart, int *largeCount, int large,
+                   int *smallStart, int *smallCount, int small){
+    int a = 0, b = 0, offA = k0, offB = k0, k;
+
+    for(k = k0; k < k1; k++){
+        while(a < large && offA >= largeCount[a])
+            offA -= largeCount[a++];
+        while(b < small && offB >= smallCount[b])
+            offB -= smallCount[b++];
+        swap(largeStart[a] + offA, smallStart[b] + offB);
+        offA++;
+        offB++;
+    }
+}
+
+/* collect the large elements left of split and the small ones right of it, from the
+   blocks partitioned by partitionLess. Returns how many elements are misplaced */
+int findMisplaced(int *blockFirst, int *less, int blocks, int split, int *largeStart, int *largeCount,
+                  int *large, int *smallStart, int *smallCount, int *small){
+    int b, first, last, misplaced = 0;
+
+    *large = *small = 0;
+    for(b = 0; b < blocks; b++){
+        /* block b is small elements, then large ones from blockFirst[b] + less[b] */
+        first = blockFirst[b] + less[b];
+        last = (blockFirst[b+1] < split)? blockFirst[b+1] : split;
+        if(last > first){
+            largeStart[*large] = first;
+            largeCount[(*large)++] = last - first;
+            misplaced += last - first;
+        }
+        first = (blockFirst[b] > split)? blockFirst[b] : split;
+        last = blockFirst[b] + less[b];
+        if(last > first){
+            smallStart[*small] = first;
+            smallCount[(*small)++] = last - first;
+        }
+    }
+    return misplaced;
+}
+
+/* partition low to high around the element at pivot like partition, with one task per block.
+   The elements smaller than the pivot end up left of it and the others right of it */
+int parallelPartition(int low, int high, int pivot){
+    int blockFirst[MAXBLOCKS+1], less[MAXBLOCKS];
+    int largeStart[MAXBLOCKS], largeCount[MAXBLOCKS], smallStart[MAXBLOCKS], smallCount[MAXBLOCKS];
+    int blocks = (threads < MAXBLOCKS)? threads : MAXBLOCKS;
+    int b, value, split, large, small, misplaced;
+
+    /* the pivot waits at high while the rest is partitioned */
+    swap(pivot, high);
+    value = array[high];
+    for(b = 0; b <= blocks; b++)
+        blockFirst[b] = low + (long)b*(high - low)/blocks;
+
+    #pragma omp taskloop grainsize(1) shared(blockFirst, less, value)
+    for(b = 0; b < blocks; b++)
+        less[b] = partitionLess(blockFirst[b], blockFirst[b+1]-1, value);
+
+    split = low;
+    for(b = 0; b < blocks; b++)
+        split += less[b];
+    misplaced = findMisplaced(blockFirst, less, blocks, split, largeStart, largeCount, &large,
+                              smallStart, smallCount, &small);
+
+    #pragma omp taskloop grainsize(1) shared(largeStart, largeCount, large, smallStart, smallCount, small, misplaced)
+    for(b = 0; b < blocks; b++)
+        swapMisplaced((long)b*misplaced/blocks, (long)(b+1)*misplaced/blocks,
+                      largeStart, largeCount, large, smallStart, smallCount, small);
+
+    swap(split, high);
+    return split;
+}
+
+int compare(const void *a, const void *b){
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* the first bucket whose splitter is larger than value, buckets-1 splitters in order */
+int findBucket(int *splitters, int buckets, int value){
+    int low = 0, high = buckets-1, middle;
+    while(low < high){
+        middle = (low+high)/2;
+        if(splitters[middle] > value)
+            high = middle;
         else
-            swap(low,high);
+            low = middle+1;
+    }
+    return low;
+}
+
+/* sort the array with sample sort, it is replaced by the sorted array */
+void samplesort(){
+    static long counts[MAXTHREADS][MAXBUCKETS];
+    int splitters[MAXBUCKETS], bucketFirst[MAXBUCKETS+1];
+    int buckets = threads*BUCKETS, samples, i, b, t;
+    unsigned int seed = 1;
+    unsigned char *bucketOf;
+    int *sample, *tmp;
+    long offset;
+
+    if(buckets > MAXBUCKETS) buckets = MAXBUCKETS;
+    if(size < buckets*OVERSAMPLE){
+        quicksort(0, size-1, MAXDEPTH);
+        return;
+    }
+
+    /* splitters from a sorted random sample, OVERSAMPLE samples apart */
+    samples = buckets*OVERSAMPLE;
+    sample = malloc(samples*sizeof(int));
+    for(i = 0; i < samples; i++)
+        sample[i] = array[rand_r(&seed) % size];
+    qsort(sample, samples, sizeof(int), compare);
+    for(b = 0; b < buckets-1; b++)
+        splitters[b] = sample[(b+1)*OVERSAMPLE];
+    free(sample);
+
+    /* every thread counts the elements of its block per bucket and remembers their buckets */
+    bucketOf = malloc(size);
+    tmp = malloc(size*sizeof(int));
+    #pragma omp parallel for private(i, b)
+    for(t = 0; t < threads; t++){
+        for(b = 0; b < buckets; b++)
+            counts[t][b] = 0;
+        for(i = (long)t*size/threads; i < (long)(t+1)*size/threads; i++){
+            b = findBucket(splitters, buckets, array[i]);
+            bucketOf[i] = b;
+            counts[t][b]++;
+        }
+    }
+
+    /* where each thread writes its elements of each bucket, buckets in order and threads in order within them */
+    offset = 0;
+    for(b = 0; b < buckets; b++){
+        bucketFirst[b] = offset;
+        for(t = 0; t < threads; t++){
+            long count = counts[t][b];
+            counts[t][b] = offset;
+            offset += count;
+        }
     }
+    bucketFirst[buckets] = size;
 
-    if(high != pivot)
-        swap(pivot, high);
+    #pragma omp parallel for private(i)
+    for(t = 0; t < threads; t++)
+        for(i = (long)t*size/threads; i < (long)(t+1)*size/threads; i++)
+            tmp[counts[t][bucketOf[i]]++] = array[i];
+    free(bucketOf);
+    free(array);
+    array = tmp;
 
-    return high;
+    /* the buckets are sorted one per task, with no further tasks */
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(b = 0; b < buckets; b++)
+        quicksort(bucketFirst[b], bucketFirst[b+1]-1, MAXDEPTH);
 }
 
-   
\ No newline at end of file
+/* merge the sorted runs from[l1..r1] and from[l2..r2] into to, starting at out. Large merges
+   are split at the middle of the longer run and where that element goes in the shorter one */
+void merge(int *from, int *to, int l1, int r1, int l2, int r2, int out){
+    int n1 = r1 - l1 + 1, n2 = r2 - l2 + 1;
+    int m1, m2, low, high;
+
+    if(n1 < n2){
+        merge(from, to, l2, r2, l1, r1, out);
+        return;
+    }
+    if(n1 + n2 < MERGECUTOFF){
+        while(l1 <= r1 && l2 <= r2)
+            to[out++] = (from[l2] < from[l1])? from[l2++] : from[l1++];
+        while(l1 <= r1)
+            to[out++] = from[l1++];
+        while(l2 <= r2)
+            to[out++] = from[l2++];
+        return;
+    }
+
+    /* the first element of the shorter run not smaller than the middle of the longer one */
+    m1 = (l1 + r1)/2;
+    low = l2;
+    high = r2 + 1;
+    while(low < high){
+        m2 = (low + high)/2;
+        if(from[m2] < from[m1])
+            low = m2 + 1;
+        else
+            high = m2;
+    }
+    m2 = low;
+    to[out + (m1 - l1) + (m2 - l2)] = from[m1];
+
+    #pragma omp task
+    merge(from, to, l1, m1-1, l2, m2-1, out);
+    merge(from, to, m1+1, r1, m2, r2, out + (m1 - l1) + (m2 - l2) + 1);
+    #pragma omp taskwait
+}
+
+/* merge sort left to right of the array, using tmp for the merges */
+void mergesort(int *tmp, int left, int right, int depth){
+    int middle = (left+right)/2, i;
+
+    if(right - left + 1 <= cutoff || depth >= MAXDEPTH){
+        quicksort(left, right, MAXDEPTH);
+        return;
+    }
+
+    #pragma omp task
+    mergesort(tmp, left, middle, depth+1);
+    mergesort(tmp, middle+1, right, depth+1);
+    #pragma omp taskwait
+
+    merge(array, tmp, left, middle, middle+1, right, left);
+    #pragma omp taskloop grainsize(MERGECUTOFF)
+    for(i = left; i <= right; i++)
+        array[i] = tmp[i];
+}
+
+/* sort the keys of the array, which are low + 0 to low + range - 1, by counting them */
+void countingsort(int low, int range){
+    long *counts = calloc((long)threads*range, sizeof(long));
+    long *first = malloc((range+1)*sizeof(long));
+    int i, k, t;
+
+    #pragma omp parallel for private(i)
+    for(t = 0; t < threads; t++)
+        for(i = (long)t*size/threads; i < (long)(t+1)*size/threads; i++)
+            counts[(long)t*range + array[i] - low]++;
+
+    /* key k goes to first[k] to first[k+1]-1 */
+    first[0] = 0;
+    for(k = 0; k < range; k++){
+        first[k+1] = first[k];
+        for(t = 0; t < threads; t++)
+            first[k+1] += counts[(long)t*range + k];
+    }
+
+    /* every thread writes a block of the array, starting with the key its first element has */
+    #pragma omp parallel for private(i, k)
+    for(t = 0; t < threads; t++){
+        int lowKey = 0, highKey = range - 1, middle;
+        i = (long)t*size/threads;
+        while(lowKey < highKey){
+            middle = (lowKey + highKey + 1)/2;
+            if(first[middle] <= i)
+                lowKey = middle;
+            else
+                highKey = middle - 1;
+        }
+        for(k = lowKey; i < (long)(t+1)*size/threads; i++){
+            while(first[k+1] <= i)
+                k++;
+            array[i] = low + k;
+        }
+    }
+    free(first);
+    free(counts);
+}
+
+/* sort the array with LSD radix sort, it is replaced by the sorted array */
+void radixsort(){
+    static long counts[MAXTHREADS][RADIX];
+    unsigned int span;
+    int low, high, shift, bits, i, d, t;
+    long offset;
+    int *tmp, *swapped;
+
+    if(size < 2)
+        return;
+    low = high = array[0];
+    #pragma omp parallel for reduction(min:low) reduction(max:high)
+    for(i = 0; i < size; i++){
+        if(array[i] < low) low = array[i];
+        if(array[i] > high) high = array[i];
+    }
+    /* the keys are sorted as their unsigned distance from low, which needs this many bits */
+    span = (unsigned int)high - (unsigned int)low;
+    if(span < COUNTINGMAX){
+        countingsort(low, span + 1);
+        return;
+    }
+    for(bits = 0; bits < 32 && (span >> bits) != 0; bits++);
+
+    tmp = malloc(size*sizeof(int));
+    for(shift = 0; shift < bits; shift += RADIXBITS){
+        #pragma omp parallel for private(i, d)
+        for(t = 0; t < threads; t++){
+            for(d = 0; d < RADIX; d++)
+                counts[t][d] = 0;
+            for(i = (long)t*size/threads; i < (long)(t+1)*size/threads; i++)
+                counts[t][(((unsigned int)array[i] - low) >> shift) & (RADIX-1)]++;
+        }
+
+        /* where each thread writes its keys of each digit, digits in order and threads in order within them */
+        offset = 0;
+        for(d = 0; d < RADIX; d++)
+            for(t = 0; t < threads; t++){
+                long count = counts[t][d];
+                counts[t][d] = offset;
+                offset += count;
+            }
+
+        /* the keys of a digit are gathered in a buffer of a cache line and written a line at a time */
+        #pragma omp parallel for private(i, d)
+        for(t = 0; t < threads; t++){
+            int buffer[RADIX][LINE], filled[RADIX];
+            for(d = 0; d < RADIX; d++)
+                filled[d] = 0;
+            for(i = (long)t*size/threads; i < (long)(t+1)*size/threads; i++){
+                d = (((unsigned int)array[i] - low) >> shift) & (RADIX-1);
+                buffer[d][filled[d]++] = array[i];
+                if(filled[d] == LINE){
+                    memcpy(tmp + counts[t][d], buffer[d], LINE*sizeof(int));
+                    counts[t][d] += LINE;
+                    filled[d] = 0;
+                }
+            }
+            for(d = 0; d < RADIX; d++)
+                memcpy(tmp + counts[t][d], buffer[d], filled[d]*sizeof(int));
+        }
+        swapped = array;
+        array = tmp;
+        tmp = swapped;
+    }
+    free(tmp);
+}
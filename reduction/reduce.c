@@ -0,0 +1,219 @@
+/* driver for the reductions of reduction.h
+
+   features: fills a rows x cols matrix of the given type (in parallel
+             in the OpenMP build) with the same seeded hash as
+             matrixSum, and reduces it
+             with every operation, with only the sum (to show what
+             the operations that are compiled away cost), and as its
+             transpose, reading it column by column through the strides.
+             Every result is checked against a serial pass, exactly
+             for the integer sums, extremes, positions and histogram
+             and to a relative 1e-9 for floating point sums and the
+             moments
+
+   usage under Linux:
+     gcc -O -o reduce reduce.c -lpthread -lm                  (pthreads)
+     gcc -O -fopenmp -DREDUCE_OPENMP -o reduce reduce.c -lm   (OpenMP)
+     ./reduce type rows cols numWorkers
+   where type is int32, int64, float or double
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include "reduction.h"
+
+#define MAXSIZE 20000  /* maximum rows and columns */
+#define SEED 1         /* seed of the matrix, the same as in matrixSum */
+#define BINS 10        /* histogram bins over [0, 99) */
+
+#define REDUCE_NAME int32All
+#define REDUCE_TYPE int32_t
+#define REDUCE_SUMTYPE int64_t
+#include "reduction_template.h"
+
+#define REDUCE_NAME int32Sum
+#define REDUCE_TYPE int32_t
+#define REDUCE_SUMTYPE int64_t
+#define REDUCE_OPS REDUCE_SUM
+#include "reduction_template.h"
+
+#define REDUCE_NAME int64All
+#define REDUCE_TYPE int64_t
+#include "reduction_template.h"
+
+#define REDUCE_NAME int64Sum
+#define REDUCE_TYPE int64_t
+#define REDUCE_OPS REDUCE_SUM
+#include "reduction_template.h"
+
+#define REDUCE_NAME floatAll
+#define REDUCE_TYPE float
+#define REDUCE_SUMTYPE double
+#include "reduction_template.h"
+
+#define REDUCE_NAME floatSum
+#define REDUCE_TYPE float
+#define REDUCE_SUMTYPE double
+#define REDUCE_OPS REDUCE_SUM
+#include "reduction_template.h"
+
+#define REDUCE_NAME doubleAll
+#define REDUCE_TYPE double
+#include "reduction_template.h"
+
+#define REDUCE_NAME doubleSum
+#define REDUCE_TYPE double
+#define REDUCE_OPS REDUCE_SUM
+#include "reduction_template.h"
+
+int rows, cols, numWorkers;
+
+/* timer */
+double read_timer() {
+    static bool initialized = false;
+    static struct timeval start;
+    struct timeval end;
+    if( !initialized )
+    {
+        gettimeofday( &start, NULL );
+        initialized = true;
+    }
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
+}
+
+/* splitmix64 hash of the seed and the position of element [i][j], the same as in matrixSum */
+unsigned long long randomBits(long long i, long long j){
+  unsigned long long z = SEED + (i*cols + j + 1)*0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+#ifdef _OPENMP
+#define PARALLEL_FOR _Pragma("omp parallel for private(j)")
+#else
+#define PARALLEL_FOR
+#endif
+
+/* integers in [0, 99) as in matrixSum, floating point values uniform in [0, 99) */
+#define FILL(type, matrix, value) \
+  { long i, j; \
+    PARALLEL_FOR \
+    for (i = 0; i < rows; i++) \
+      for (j = 0; j < cols; j++) \
+        (matrix)[i*cols + j] = (type)(value); }
+
+/* print a result, the value type is printed as a double */
+#define PRINT(label, name, r, time) \
+  { int k; \
+    printf("%s\n", label); \
+    printf("  count %lld, sum %.17g\n", (r).count, (double)(r).sum); \
+    printf("  min %g at [%ld,%ld], max %g at [%ld,%ld]\n", (double)(r).min, (r).minRow, (r).minCol, \
+           (double)(r).max, (r).maxRow, (r).maxCol); \
+    printf("  mean %.17g, variance %.17g\n", name##_mean(&(r)), name##_variance(&(r))); \
+    printf("  histogram"); \
+    for (k = 0; k < (r).bins; k++) \
+      printf(" %lld", (r).histogram[k]); \
+    printf("\n  took %g sec\n", time); }
+
+/* true if x and y differ by at most a relative 1e-9, or exactly if exact */
+bool agrees(double x, double y, bool exact){
+  if (exact)
+    return x == y;
+  return fabs(x - y) <= 1e-9 * fmax(fabs(x), fabs(y));
+}
+
+/* check r against a serial pass over the rows x cols array at data, read through the strides */
+#define CHECK(label, type, data, rows, cols, rowStride, colStride, r, exact) \
+  { long i, j; \
+    int k; \
+    long long count = 0, histogram[BINS] = {0}; \
+    double sum = 0.0, mean = 0.0, m2 = 0.0, delta, x, scale = BINS / 99.0; \
+    type min = (data)[0], max = (data)[0], v; \
+    long minRow = 0, minCol = 0, maxRow = 0, maxCol = 0; \
+    bool right = true; \
+    for (i = 0; i < (rows); i++) \
+      for (j = 0; j < (cols); j++) { \
+        v = (data)[i*(rowStride) + j*(colStride)]; \
+        sum += v; \
+        if (v < min) { min = v; minRow = i; minCol = j; } \
+        if (v > max) { max = v; maxRow = i; maxCol = j; } \
+        x = (double)v * scale; \
+        if (x >= 0 && x < BINS) histogram[(int)x]++; \
+        count++; \
+        delta = (double)v - mean; \
+        mean += delta / count; \
+        m2 += delta * ((double)v - mean); \
+      } \
+    if ((r).count != count) { printf("The count of %s is wrong\n", label); right = false; } \
+    if (!agrees((double)(r).sum, sum, exact)) { printf("The sum of %s is wrong\n", label); right = false; } \
+    if ((r).min != min || (r).minRow != minRow || (r).minCol != minCol) \
+      { printf("The min of %s is wrong\n", label); right = false; } \
+    if ((r).max != max || (r).maxRow != maxRow || (r).maxCol != maxCol) \
+      { printf("The max of %s is wrong\n", label); right = false; } \
+    for (k = 0; k < BINS; k++) \
+      if ((r).histogram[k] != histogram[k]) { printf("The histogram of %s is wrong\n", label); right = false; break; } \
+    if (!agrees((r).mean, mean, false) || !agrees((r).m2, m2, false)) \
+      { printf("The moments of %s are wrong\n", label); right = false; } \
+    if (right) printf("  checked\n"); }
+
+/* reduce the matrix with every operation, only the sum, and as its transpose */
+#define RUN(type, allOps, sumOnly, value, exact) \
+  { type *matrix = malloc((size_t)rows*cols*sizeof(type)); \
+    allOps##_result r, t; \
+    sumOnly##_result s; \
+    double start; \
+    if (matrix == NULL) { fprintf(stderr, "out of memory\n"); return 1; } \
+    FILL(type, matrix, value) \
+    allOps##_init(&r, BINS, 0.0, 99.0); \
+    start = read_timer(); \
+    allOps##_reduce(matrix, rows, cols, cols, 1, numWorkers, &r); \
+    PRINT("all operations", allOps, r, read_timer() - start) \
+    CHECK("all operations", type, matrix, rows, cols, cols, 1, r, exact) \
+    sumOnly##_init(&s, 0, 0.0, 0.0); \
+    start = read_timer(); \
+    sumOnly##_reduce(matrix, rows, cols, cols, 1, numWorkers, &s); \
+    printf("sum only\n  sum %.17g\n  took %g sec\n", (double)s.sum, read_timer() - start); \
+    if (s.sum != r.sum) printf("The sum only sum is not the sum of all operations\n"); \
+    allOps##_init(&t, BINS, 0.0, 99.0); \
+    start = read_timer(); \
+    allOps##_reduce(matrix, cols, rows, 1, cols, numWorkers, &t); \
+    PRINT("transpose", allOps, t, read_timer() - start) \
+    CHECK("transpose", type, matrix, cols, rows, 1, cols, t, exact) \
+    free(matrix); }
+
+int main(int argc, char *argv[]) {
+  const char *type;
+
+  /* read command line args if any */
+  type = (argc > 1)? argv[1] : "int32";
+  rows = (argc > 2)? atoi(argv[2]) : MAXSIZE;
+  cols = (argc > 3)? atoi(argv[3]) : MAXSIZE;
+  numWorkers = (argc > 4)? atoi(argv[4]) : REDUCE_MAXWORKERS;
+  if (rows > MAXSIZE) rows = MAXSIZE;
+  if (cols > MAXSIZE) cols = MAXSIZE;
+  if (rows < 1) rows = 1;
+  if (cols < 1) cols = 1;
+  if (numWorkers > REDUCE_MAXWORKERS) numWorkers = REDUCE_MAXWORKERS;
+
+  printf("%s %d x %d, %d workers\n", type, rows, cols, numWorkers);
+  if (strcmp(type, "int32") == 0)
+    RUN(int32_t, int32All, int32Sum, randomBits(i, j) % 99, true)
+  else if (strcmp(type, "int64") == 0)
+    RUN(int64_t, int64All, int64Sum, randomBits(i, j) % 99, true)
+  else if (strcmp(type, "float") == 0)
+    RUN(float, floatAll, floatSum, (randomBits(i, j) >> 11) * 0x1.0p-53 * 99.0, false)
+  else if (strcmp(type, "double") == 0)
+    RUN(double, doubleAll, doubleSum, (randomBits(i, j) >> 11) * 0x1.0p-53 * 99.0, false)
+  else {
+    fprintf(stderr, "unknown type %s, use int32, int64, float or double\n", type);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,68 @@
+/* parallel reductions over strided 2D arrays
+
+   features: a reduction is generated for one element type and one
+             set of operations by defining REDUCE_NAME, REDUCE_TYPE,
+             REDUCE_SUMTYPE and REDUCE_OPS and including
+             reduction_template.h. REDUCE_OPS is a constant, so the
+             operations that are not asked for are compiled away:
+               REDUCE_SUM        sum, accumulated in REDUCE_SUMTYPE
+               REDUCE_MIN/MAX    smallest/largest value
+               REDUCE_ARGMIN/MAX and its first position in row major order
+               REDUCE_HISTOGRAM  counts in bins equal width bins of [low, high)
+               REDUCE_MOMENTS    mean and variance, with Welford's update
+             Element [i][j] of a rows x cols array is read from
+             data[i*rowStride + j*colStride], so a block, a transpose
+             or every other column of a matrix is reduced in place.
+             The rows are split in chunks of about REDUCE_CHUNK
+             elements, which depend on the number of columns only.
+             The workers reduce the chunks in turn, each into its own
+             partial result, and the partial results are merged in
+             chunk order. So the result is the same for any number of
+             workers, to the last bit also for floating point. Workers
+             are pthreads, or OpenMP threads with -DREDUCE_OPENMP
+
+   usage:
+     #include "reduction.h"
+
+     #define REDUCE_NAME intStats
+     #define REDUCE_TYPE int32_t
+     #define REDUCE_SUMTYPE int64_t
+     #define REDUCE_OPS (REDUCE_SUM | REDUCE_ARGMAX | REDUCE_MOMENTS)
+     #include "reduction_template.h"
+
+     intStats_result r;
+     intStats_init(&r, 0, 0.0, 0.0);
+     intStats_reduce(matrix, rows, cols, rowStride, 1, workers, &r);
+
+*/
+#ifndef REDUCTION_H
+#define REDUCTION_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef REDUCE_OPENMP
+#include <omp.h>
+#else
+#include <pthread.h>
+#endif
+
+#define REDUCE_SUM 1
+#define REDUCE_MIN 2
+#define REDUCE_MAX 4
+#define REDUCE_ARGMIN 8
+#define REDUCE_ARGMAX 16
+#define REDUCE_HISTOGRAM 32
+#define REDUCE_MOMENTS 64
+#define REDUCE_ALL 127
+
+#define REDUCE_MAXWORKERS 64   /* maximum number of workers */
+#define REDUCE_MAXBINS 256     /* maximum number of histogram bins */
+#define REDUCE_CHUNK 65536     /* elements in a chunk of rows, at least one row */
+
+/* REDUCE_FN(_reduce) is <REDUCE_NAME>_reduce */
+#define REDUCE_CAT2(a, b) a##b
+#define REDUCE_CAT(a, b) REDUCE_CAT2(a, b)
+#define REDUCE_FN(suffix) REDUCE_CAT(REDUCE_NAME, suffix)
+
+#endif
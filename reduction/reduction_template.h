@@ -0,0 +1,235 @@
+/* one reduction of reduction.h, included once for every REDUCE_NAME
+
+   REDUCE_NAME     prefix of the generated type and functions
+   REDUCE_TYPE     element type
+   REDUCE_SUMTYPE  type the sum is accumulated in (default REDUCE_TYPE)
+   REDUCE_OPS      operations, REDUCE_SUM | REDUCE_MIN | ... (default REDUCE_ALL)
+
+   generates:
+     REDUCE_NAME_result                the result, set up with _init
+     REDUCE_NAME_init(r, bins, low, high)
+     REDUCE_NAME_reduce(data, rows, cols, rowStride, colStride, workers, r)
+     REDUCE_NAME_mean(r), REDUCE_NAME_variance(r)
+
+   The parameters are undefined at the end, so the next reduction can be
+   generated right after.
+*/
+#include "reduction.h"
+
+#ifndef REDUCE_NAME
+#error "define REDUCE_NAME before including reduction_template.h"
+#endif
+#ifndef REDUCE_TYPE
+#error "define REDUCE_TYPE before including reduction_template.h"
+#endif
+#ifndef REDUCE_SUMTYPE
+#define REDUCE_SUMTYPE REDUCE_TYPE
+#endif
+#ifndef REDUCE_OPS
+#define REDUCE_OPS REDUCE_ALL
+#endif
+
+typedef struct{
+  long long count;                       /* number of elements reduced */
+  REDUCE_SUMTYPE sum;
+  REDUCE_TYPE min, max;
+  long minRow, minCol, maxRow, maxCol;   /* first position of min and max */
+  double mean, m2;                       /* running mean and sum of squared differences from it */
+  double low, high;                      /* range of the histogram */
+  int bins;
+  long long histogram[REDUCE_MAXBINS];
+} REDUCE_FN(_result);
+
+/* the chunks one worker reduces, chunk c is rows c*chunkRows to (c+1)*chunkRows-1 */
+typedef struct{
+  const REDUCE_TYPE *data;
+  long rows, cols, rowStride, colStride, chunkRows, chunks;
+  int worker, workers;
+  REDUCE_FN(_result) *results;
+} REDUCE_FN(_task);
+
+/* empty result, with a histogram of bins bins over [low, high) if REDUCE_HISTOGRAM is asked for */
+static inline void REDUCE_FN(_init)(REDUCE_FN(_result) *r, int bins, double low, double high){
+  memset(r, 0, sizeof(*r));
+  r->bins = (bins > REDUCE_MAXBINS) ? REDUCE_MAXBINS : (bins < 0) ? 0 : bins;
+  r->low = low;
+  r->high = high;
+}
+
+static inline double REDUCE_FN(_mean)(const REDUCE_FN(_result) *r){
+  return r->mean;
+}
+
+/* sample variance, 0 with less than two elements */
+static inline double REDUCE_FN(_variance)(const REDUCE_FN(_result) *r){
+  return (r->count > 1) ? r->m2 / (r->count - 1) : 0.0;
+}
+
+/* add value v at [i][j] to r, the first value was put in r before, so the compares can be strict */
+static inline void REDUCE_FN(_visit)(REDUCE_FN(_result) *r, REDUCE_TYPE v, long i, long j, double scale){
+  if (REDUCE_OPS & REDUCE_SUM)
+    r->sum += v;
+  if ((REDUCE_OPS & (REDUCE_MIN | REDUCE_ARGMIN)) && v < r->min) {
+    r->min = v;
+    if (REDUCE_OPS & REDUCE_ARGMIN) {
+      r->minRow = i;
+      r->minCol = j;
+    }
+  }
+  if ((REDUCE_OPS & (REDUCE_MAX | REDUCE_ARGMAX)) && v > r->max) {
+    r->max = v;
+    if (REDUCE_OPS & REDUCE_ARGMAX) {
+      r->maxRow = i;
+      r->maxCol = j;
+    }
+  }
+  if (REDUCE_OPS & REDUCE_HISTOGRAM) {
+    double x = ((double)v - r->low) * scale;
+    if (x >= 0 && x < r->bins)
+      r->histogram[(int)x]++;
+  }
+  r->count++;
+  if (REDUCE_OPS & REDUCE_MOMENTS) {
+    double delta = (double)v - r->mean;
+    r->mean += delta / r->count;
+    r->m2 += delta * ((double)v - r->mean);
+  }
+}
+
+/* reduce rows [first, last) into r */
+static void REDUCE_FN(_block)(const REDUCE_TYPE *data, long first, long last, long cols,
+                              long rowStride, long colStride, REDUCE_FN(_result) *r){
+  long i, j;
+  double scale = (r->high > r->low) ? r->bins / (r->high - r->low) : 0.0;
+
+  if (first >= last || cols < 1)
+    return;
+  if (r->count == 0) {
+    r->min = r->max = data[first*rowStride];
+    r->minRow = r->maxRow = first;
+    r->minCol = r->maxCol = 0;
+  }
+  for (i = first; i < last; i++) {
+    const REDUCE_TYPE *row = data + i*rowStride;
+    if (colStride == 1) {
+      for (j = 0; j < cols; j++)
+        REDUCE_FN(_visit)(r, row[j], i, j, scale);
+    }
+    else {
+      for (j = 0; j < cols; j++)
+        REDUCE_FN(_visit)(r, row[j*colStride], i, j, scale);
+    }
+  }
+}
+
+/* merge b, of rows after the ones of a, into a. The moments are combined as in Chan et al. */
+static void REDUCE_FN(_merge)(REDUCE_FN(_result) *a, const REDUCE_FN(_result) *b){
+  int k;
+  long long n;
+  double delta;
+
+  if (b->count == 0)
+    return;
+  if (a->count == 0) {
+    *a = *b;
+    return;
+  }
+  if (REDUCE_OPS & REDUCE_SUM)
+    a->sum += b->sum;
+  if (b->min < a->min) {
+    a->min = b->min;
+    a->minRow = b->minRow;
+    a->minCol = b->minCol;
+  }
+  if (b->max > a->max) {
+    a->max = b->max;
+    a->maxRow = b->maxRow;
+    a->maxCol = b->maxCol;
+  }
+  if (REDUCE_OPS & REDUCE_HISTOGRAM)
+    for (k = 0; k < a->bins; k++)
+      a->histogram[k] += b->histogram[k];
+  n = a->count + b->count;
+  if (REDUCE_OPS & REDUCE_MOMENTS) {
+    delta = b->mean - a->mean;
+    a->mean += delta * b->count / n;
+    a->m2 += b->m2 + delta * delta * ((double)a->count * b->count / n);
+  }
+  a->count = n;
+}
+
+/* reduce chunk c into its own result */
+static void REDUCE_FN(_chunk)(const REDUCE_FN(_task) *t, long c){
+  long last = (c + 1)*t->chunkRows;
+  REDUCE_FN(_block)(t->data, c*t->chunkRows, (last < t->rows) ? last : t->rows, t->cols,
+                    t->rowStride, t->colStride, &t->results[c]);
+}
+
+#ifndef REDUCE_OPENMP
+/* worker w reduces chunks w, w + workers, ... */
+static void *REDUCE_FN(_worker)(void *arg){
+  REDUCE_FN(_task) *t = (REDUCE_FN(_task) *) arg;
+  long c;
+  for (c = t->worker; c < t->chunks; c += t->workers)
+    REDUCE_FN(_chunk)(t, c);
+  return NULL;
+}
+#endif
+
+/* reduce the rows x cols array at data into r, which holds the histogram set up by _init.
+   r is reset before, so reducing a second array into it starts over */
+static void REDUCE_FN(_reduce)(const REDUCE_TYPE *data, long rows, long cols, long rowStride,
+                               long colStride, int workers, REDUCE_FN(_result) *r){
+  REDUCE_FN(_task) tasks[REDUCE_MAXWORKERS];
+  REDUCE_FN(_result) *results;
+  long chunkRows = (cols < REDUCE_CHUNK) ? REDUCE_CHUNK / (cols > 0 ? cols : 1) : 1;
+  long chunks = (rows + chunkRows - 1) / chunkRows, c;
+  int w;
+#ifndef REDUCE_OPENMP
+  pthread_t workerid[REDUCE_MAXWORKERS];
+#endif
+
+  if (workers > REDUCE_MAXWORKERS) workers = REDUCE_MAXWORKERS;
+  if (workers > chunks) workers = chunks;
+  if (workers < 1) workers = 1;
+  results = malloc((chunks > 0 ? chunks : 1)*sizeof(REDUCE_FN(_result)));
+  for (c = 0; c < chunks; c++)
+    REDUCE_FN(_init)(&results[c], r->bins, r->low, r->high);
+
+  for (w = 0; w < workers; w++) {
+    tasks[w].data = data;
+    tasks[w].rows = rows;
+    tasks[w].cols = cols;
+    tasks[w].rowStride = rowStride;
+    tasks[w].colStride = colStride;
+    tasks[w].chunkRows = chunkRows;
+    tasks[w].chunks = chunks;
+    tasks[w].worker = w;
+    tasks[w].workers = workers;
+    tasks[w].results = results;
+  }
+
+#ifdef REDUCE_OPENMP
+#pragma omp parallel for num_threads(workers) schedule(static, 1)
+  for (c = 0; c < chunks; c++)
+    REDUCE_FN(_chunk)(&tasks[0], c);
+#else
+  /* the calling thread is worker 0 */
+  for (w = 1; w < workers; w++)
+    pthread_create(&workerid[w], NULL, REDUCE_FN(_worker), &tasks[w]);
+  REDUCE_FN(_worker)(&tasks[0]);
+  for (w = 1; w < workers; w++)
+    pthread_join(workerid[w], NULL);
+#endif
+
+  /* the chunks depend on cols only, so merging them in order gives the same result for any workers */
+  REDUCE_FN(_init)(r, r->bins, r->low, r->high);
+  for (c = 0; c < chunks; c++)
+    REDUCE_FN(_merge)(r, &results[c]);
+  free(results);
+}
+
+#undef REDUCE_NAME
+#undef REDUCE_TYPE
+#undef REDUCE_SUMTYPE
+#undef REDUCE_OPS
@@ -0,0 +1,175 @@
+/* driver for the sorts of sorting.h
+
+   features: fills an array of the given type with keys from the same
+             seeded hash as reduce, drawn from values distinct values,
+             and sorts it with qsort, then with _sort and with _stable
+             into a buffer allocated here. Both results are checked to
+             be the same as the one of qsort, the keys for pair, so a
+             lost or repeated element is found. pair is a 64-bit key
+             with the index it was filled at as value, so the stable
+             sort is also checked to keep equal keys in order
+
+   usage under Linux:
+     gcc -O -o sort sort.c
+     ./sort type size values
+   where type is int32, int64, double or pair
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "sorting.h"
+
+#define MAXSIZE 100000000  /* maximum array size */
+#define SEED 1             /* seed of the keys, the same as in reduce */
+#define VALUES 99          /* default number of distinct keys */
+
+typedef struct{
+  uint64_t key;
+  uint64_t value;
+} pair;
+
+#define SORT_NAME int32Sort
+#define SORT_TYPE int32_t
+#include "sorting_template.h"
+
+#define SORT_NAME int64Sort
+#define SORT_TYPE int64_t
+#include "sorting_template.h"
+
+#define SORT_NAME doubleSort
+#define SORT_TYPE double
+#include "sorting_template.h"
+
+#define SORT_NAME pairSort
+#define SORT_TYPE pair
+#define SORT_LESS(a, b) ((a).key < (b).key)
+#include "sorting_template.h"
+
+long size;
+long long values;
+
+/* timer */
+double read_timer() {
+    static bool initialized = false;
+    static struct timeval start;
+    struct timeval end;
+    if( !initialized )
+    {
+        gettimeofday( &start, NULL );
+        initialized = true;
+    }
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
+}
+
+/* splitmix64 hash of the seed and the index i, the same as in reduce */
+unsigned long long randomBits(long long i){
+  unsigned long long z = SEED + (i + 1)*0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* qsort comparisons, for the time a call per comparison takes */
+#define COMPARE(name, type, key) \
+  int name(const void *a, const void *b) { \
+    const type *x = (const type *)a, *y = (const type *)b; \
+    return (key(*x) > key(*y)) - (key(*x) < key(*y)); }
+#define PLAIN(x) (x)
+#define PAIRKEY(x) ((x).key)
+COMPARE(compareInt32, int32_t, PLAIN)
+COMPARE(compareInt64, int64_t, PLAIN)
+COMPARE(compareDouble, double, PLAIN)
+COMPARE(comparePair, pair, PAIRKEY)
+
+#define FILL(type, a, set) \
+  { long i; \
+    for (i = 0; i < size; i++) { \
+      type *e = &(a)[i]; \
+      set; } }
+
+/* the first pair with another key than in expected, n if there is none */
+long differentKeys(const pair *a, const pair *expected, long n){
+  long i;
+  for (i = 0; i < n; i++)
+    if (a[i].key != expected[i].key)
+      return i;
+  return n;
+}
+
+/* the first element other than in expected, n if there is none */
+#define DIFFERENT(a, expected, n) \
+  { for (at = 0; at < (n) && memcmp(&(a)[at], &(expected)[at], sizeof((a)[0])) == 0; at++); }
+
+/* the first pair out of order, or with a smaller value than the one before with the same key */
+long unstable(const pair *a, long n){
+  long i;
+  for (i = 1; i < n; i++)
+    if (a[i].key < a[i-1].key || (a[i].key == a[i-1].key && a[i].value < a[i-1].value))
+      return i;
+  return n;
+}
+
+/* sort the array with qsort, _sort and _stable, from the same keys every time. different is
+   the first element of a other than in expected, stability the first element the stable sort
+   got wrong, size if none */
+#define RUN(type, name, compare, set, different, stability) \
+  { type *a = malloc(size*sizeof(type)), *buffer = malloc(size*sizeof(type)); \
+    type *expected = malloc(size*sizeof(type)); \
+    double start; \
+    long at; \
+    if (a == NULL || buffer == NULL || expected == NULL) { fprintf(stderr, "out of memory\n"); return 1; } \
+    FILL(type, expected, set) \
+    start = read_timer(); \
+    qsort(expected, size, sizeof(type), compare); \
+    printf("qsort took %g sec\n", read_timer() - start); \
+    FILL(type, a, set) \
+    start = read_timer(); \
+    name##_sort(a, size); \
+    printf("sort took %g sec\n", read_timer() - start); \
+    if ((at = name##_sorted(a, size)) < size) printf("The array is not sorted at %ld\n", at); \
+    different; \
+    if (at < size) printf("The sort differs from qsort at %ld\n", at); \
+    FILL(type, a, set) \
+    start = read_timer(); \
+    name##_stable(a, size, buffer); \
+    printf("stable took %g sec\n", read_timer() - start); \
+    if ((at = name##_sorted(a, size)) < size) printf("The array is not sorted at %ld\n", at); \
+    different; \
+    if (at < size) printf("The stable sort differs from qsort at %ld\n", at); \
+    if ((at = (stability)) < size) printf("The stable sort swapped equal keys at %ld\n", at); \
+    free(expected); \
+    free(buffer); \
+    free(a); }
+
+int main(int argc, char *argv[]) {
+  const char *type;
+
+  /* read command line args if any */
+  type = (argc > 1)? argv[1] : "int32";
+  size = (argc > 2)? atol(argv[2]) : MAXSIZE;
+  values = (argc > 3)? atoll(argv[3]) : VALUES;
+  if (size > MAXSIZE) size = MAXSIZE;
+  if (size < 1) size = 1;
+  if (values < 1) values = 1;
+
+  printf("%s %ld elements of %lld values\n", type, size, values);
+  if (strcmp(type, "int32") == 0)
+    RUN(int32_t, int32Sort, compareInt32, *e = randomBits(i) % values, DIFFERENT(a, expected, size), size)
+  else if (strcmp(type, "int64") == 0)
+    RUN(int64_t, int64Sort, compareInt64, *e = randomBits(i) % values, DIFFERENT(a, expected, size), size)
+  else if (strcmp(type, "double") == 0)
+    RUN(double, doubleSort, compareDouble, *e = (randomBits(i) >> 11) * 0x1.0p-53 * values, DIFFERENT(a, expected, size), size)
+  else if (strcmp(type, "pair") == 0)
+    RUN(pair, pairSort, comparePair, e->key = randomBits(i) % values; e->value = i,
+        at = differentKeys(a, expected, size), unstable(a, size))
+  else {
+    fprintf(stderr, "unknown type %s, use int32, int64, double or pair\n", type);
+    return 1;
+  }
+  return 0;
+}
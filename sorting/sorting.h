@@ -0,0 +1,48 @@
+/* sorting of arrays of any element type, with the comparison inlined
+
+   features: a sort is generated for one element type by defining
+             SORT_NAME, SORT_TYPE and SORT_LESS and including
+             sorting_template.h. SORT_LESS(a, b) is an expression on
+             two elements, so it is compiled into the loops instead of
+             called through a pointer as with qsort. Records and key
+             value pairs are sorted as structs, with SORT_LESS on the
+             key. The caller owns the arrays, of any length:
+               _sort(a, n)             introsort: quicksort with the
+                                       median of three or the ninther
+                                       as pivot, insertion sort for small
+                                       ranges and heapsort when the
+                                       recursion gets too deep, in place
+               _stable(a, n, buffer)   merge sort, equal elements keep
+                                       their order, with a buffer of n
+                                       elements (allocated if NULL)
+               _sorted(a, n)           index of the first element out
+                                       of order, n if there is none
+
+   usage:
+     #include "sorting.h"
+
+     typedef struct{ uint64_t key; uint32_t value; } pair;
+     #define SORT_NAME pairSort
+     #define SORT_TYPE pair
+     #define SORT_LESS(a, b) ((a).key < (b).key)
+     #include "sorting_template.h"
+
+     pairSort_stable(pairs, n, buffer);
+
+*/
+#ifndef SORTING_H
+#define SORTING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SORT_INSERTION 32   /* ranges this small are sorted with insertion sort */
+#define SORT_NINTHER 128    /* ranges this large take the ninther as pivot */
+
+/* SORT_FN(_sort) is <SORT_NAME>_sort */
+#define SORT_CAT2(a, b) a##b
+#define SORT_CAT(a, b) SORT_CAT2(a, b)
+#define SORT_FN(suffix) SORT_CAT(SORT_NAME, suffix)
+
+#endif
@@ -0,0 +1,208 @@
+/* one sort of sorting.h, included once for every SORT_NAME
+
+   SORT_NAME        prefix of the generated functions
+   SORT_TYPE        element type
+   SORT_LESS(a, b)  true if element a goes before element b (default (a) < (b))
+
+   generates:
+     SORT_NAME_sort(a, n)
+     SORT_NAME_stable(a, n, buffer), 0 or -1 if the buffer could not be allocated
+     SORT_NAME_sorted(a, n)
+
+   The parameters are undefined at the end, so the next sort can be
+   generated right after.
+*/
+#include "sorting.h"
+
+#ifndef SORT_NAME
+#error "define SORT_NAME before including sorting_template.h"
+#endif
+#ifndef SORT_TYPE
+#error "define SORT_TYPE before including sorting_template.h"
+#endif
+#ifndef SORT_LESS
+#define SORT_LESS(a, b) ((a) < (b))
+#endif
+
+static inline void SORT_FN(_swap)(SORT_TYPE *a, long i, long j){
+  SORT_TYPE t = a[i];
+  a[i] = a[j];
+  a[j] = t;
+}
+
+/* insertion sort of a[first] to a[last], equal elements keep their order */
+static void SORT_FN(_insertion)(SORT_TYPE *a, long first, long last){
+  long i, j;
+  SORT_TYPE v;
+
+  for (i = first + 1; i <= last; i++) {
+    v = a[i];
+    for (j = i; j > first && SORT_LESS(v, a[j-1]); j--)
+      a[j] = a[j-1];
+    a[j] = v;
+  }
+}
+
+/* the index of the median of a[i], a[j] and a[k] */
+static inline long SORT_FN(_median3)(const SORT_TYPE *a, long i, long j, long k){
+  if (SORT_LESS(a[i], a[j]))
+    return SORT_LESS(a[j], a[k]) ? j : SORT_LESS(a[i], a[k]) ? k : i;
+  return SORT_LESS(a[i], a[k]) ? i : SORT_LESS(a[j], a[k]) ? k : j;
+}
+
+/* the median of three for small ranges and Tukey's ninther for large ones */
+static long SORT_FN(_pivot)(const SORT_TYPE *a, long first, long last){
+  long middle = first + (last - first)/2, step;
+
+  if (last - first + 1 < SORT_NINTHER)
+    return SORT_FN(_median3)(a, first, middle, last);
+  step = (last - first)/8;
+  return SORT_FN(_median3)(a, SORT_FN(_median3)(a, first, first + step, first + 2*step),
+                           SORT_FN(_median3)(a, middle - step, middle, middle + step),
+                           SORT_FN(_median3)(a, last - 2*step, last - step, last));
+}
+
+/* partition low to high around the element at pivot and return where it ends up. Both scans
+   stop on elements equal to the pivot, so duplicates are spread over both sides */
+static long SORT_FN(_partition)(SORT_TYPE *a, long low, long high, long pivot){
+  long i = low, j = high + 1;
+  SORT_TYPE v;
+
+  SORT_FN(_swap)(a, low, pivot);
+  v = a[low];
+  for (;;) {
+    while (SORT_LESS(a[++i], v))
+      if (i == high)
+        break;
+    while (SORT_LESS(v, a[--j]))
+      if (j == low)
+        break;
+    if (i >= j)
+      break;
+    SORT_FN(_swap)(a, i, j);
+  }
+  SORT_FN(_swap)(a, low, j);
+  return j;
+}
+
+/* move a[root] down the heap of the n elements at a */
+static void SORT_FN(_siftDown)(SORT_TYPE *a, long root, long n){
+  long child;
+  SORT_TYPE v = a[root];
+
+  while ((child = 2*root + 1) < n) {
+    if (child + 1 < n && SORT_LESS(a[child], a[child+1]))
+      child++;
+    if (!SORT_LESS(v, a[child]))
+      break;
+    a[root] = a[child];
+    root = child;
+  }
+  a[root] = v;
+}
+
+static void SORT_FN(_heapsort)(SORT_TYPE *a, long n){
+  long i;
+
+  for (i = n/2 - 1; i >= 0; i--)
+    SORT_FN(_siftDown)(a, i, n);
+  for (i = n - 1; i > 0; i--) {
+    SORT_FN(_swap)(a, 0, i);
+    SORT_FN(_siftDown)(a, 0, i);
+  }
+}
+
+/* quicksort a[first] to a[last], with heapsort when depth runs out. The smaller side is
+   sorted by recursion and the larger one by the loop, so the stack stays logarithmic */
+static void SORT_FN(_introsort)(SORT_TYPE *a, long first, long last, int depth){
+  long pivot;
+
+  while (last - first + 1 > SORT_INSERTION) {
+    if (depth-- == 0) {
+      SORT_FN(_heapsort)(a + first, last - first + 1);
+      return;
+    }
+    pivot = SORT_FN(_partition)(a, first, last, SORT_FN(_pivot)(a, first, last));
+    if (pivot - first < last - pivot) {
+      SORT_FN(_introsort)(a, first, pivot - 1, depth);
+      first = pivot + 1;
+    }
+    else {
+      SORT_FN(_introsort)(a, pivot + 1, last, depth);
+      last = pivot - 1;
+    }
+  }
+  SORT_FN(_insertion)(a, first, last);
+}
+
+/* sort the n elements at a in place */
+static void SORT_FN(_sort)(SORT_TYPE *a, long n){
+  int depth = 0;
+  long m;
+
+  for (m = n; m > 1; m >>= 1)
+    depth += 2;
+  if (n > 1)
+    SORT_FN(_introsort)(a, 0, n - 1, depth);
+}
+
+/* merge the runs from[first] to from[middle-1] and from[middle] to from[last-1] into to,
+   on ties the element of the first run goes first */
+static void SORT_FN(_merge)(const SORT_TYPE *from, SORT_TYPE *to, long first, long middle, long last){
+  long i = first, j = middle, k = first;
+
+  while (i < middle && j < last)
+    to[k++] = SORT_LESS(from[j], from[i]) ? from[j++] : from[i++];
+  while (i < middle)
+    to[k++] = from[i++];
+  while (j < last)
+    to[k++] = from[j++];
+}
+
+/* stable sort of the n elements at a. Runs of SORT_INSERTION elements are insertion sorted,
+   then merged pairwise back and forth between a and buffer, which holds n elements. A NULL
+   buffer is allocated and freed here. Returns 0, or -1 if it could not be allocated */
+static int SORT_FN(_stable)(SORT_TYPE *a, long n, SORT_TYPE *buffer){
+  SORT_TYPE *from = a, *to, *swapped, *allocated = NULL;
+  long width, first, middle, last;
+
+  for (first = 0; first < n; first += SORT_INSERTION)
+    SORT_FN(_insertion)(a, first, (first + SORT_INSERTION < n ? first + SORT_INSERTION : n) - 1);
+  if (n <= SORT_INSERTION)
+    return 0;
+  if (buffer == NULL) {
+    buffer = allocated = malloc(n*sizeof(SORT_TYPE));
+    if (buffer == NULL)
+      return -1;
+  }
+
+  to = buffer;
+  for (width = SORT_INSERTION; width < n; width *= 2) {
+    for (first = 0; first < n; first += 2*width) {
+      middle = (first + width < n) ? first + width : n;
+      last = (first + 2*width < n) ? first + 2*width : n;
+      SORT_FN(_merge)(from, to, first, middle, last);
+    }
+    swapped = from;
+    from = to;
+    to = swapped;
+  }
+  if (from != a)
+    memcpy(a, from, n*sizeof(SORT_TYPE));
+  free(allocated);
+  return 0;
+}
+
+/* the index of the first element that goes before the one ahead of it, n if a is sorted */
+static long SORT_FN(_sorted)(const SORT_TYPE *a, long n){
+  long i;
+
+  for (i = 1; i < n; i++)
+    if (SORT_LESS(a[i], a[i-1]))
+      return i;
+  return n;
+}
+
+#undef SORT_NAME
+#undef SORT_TYPE
+#undef SORT_LESS